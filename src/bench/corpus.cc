@@ -0,0 +1,272 @@
+#include "bench/corpus.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+namespace Bench
+{
+
+namespace
+{
+
+std::vector<std::string> const words {
+  "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+  "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa",
+  "quebec", "romeo", "sierra", "tango", "uniform", "victor", "whiskey",
+  "xray", "yankee", "zulu", "select", "from", "where", "insert", "into",
+  "values", "line", "foo", "1024", "42", "{", "}", "(", ")", ";",
+};
+
+// fixed seed, the output of std::mt19937 is the same on every platform
+class Text
+{
+public:
+
+  Text(std::uint32_t seed) :
+    rng_ {seed}
+  {
+  }
+
+  std::string const& word()
+  {
+    return words.at(rng_() % words.size());
+  }
+
+  std::size_t num(std::size_t max)
+  {
+    return rng_() % max;
+  }
+
+  // a line of about size chars, without the newline
+  std::string line(std::size_t size)
+  {
+    std::string str;
+    while (str.size() < size)
+    {
+      if (! str.empty())
+      {
+        str += " ";
+      }
+      str += word();
+    }
+    return str;
+  }
+
+private:
+
+  std::mt19937 rng_;
+}; // class Text
+
+std::size_t write(fs::path const& path, std::string const& str)
+{
+  std::ofstream file {path, std::ios::binary | std::ios::trunc};
+  if (! file.is_open())
+  {
+    throw std::runtime_error("could not write the corpus file '" + path.string() + "'");
+  }
+  file.write(str.data(), static_cast<std::streamsize>(str.size()));
+  return str.size();
+}
+
+void passthrough(Corpus& c, std::size_t scale)
+{
+  Text t {1};
+  std::string str;
+  while (str.size() < scale * (16ul << 20))
+  {
+    str += t.line(72) + "\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void dense(Corpus& c, std::size_t scale)
+{
+  Text t {2};
+  std::string str;
+  for (std::size_t i = 0; i < scale * 100000; ++i)
+  {
+    str += t.word() + " [M8[ + " + std::to_string(t.num(1000)) + " " + std::to_string(t.num(1000)) + " ]8M] ";
+    str += t.word() + " [M8[ nop " + t.word() + " ]8M] ";
+    str += "[M8[ uppercase 0 3 " + t.word() + " ]8M]\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void nested(Corpus& c, std::size_t scale)
+{
+  Text t {3};
+  std::size_t const depth {24};
+  std::string str;
+  for (std::size_t i = 0; i < scale * 5000; ++i)
+  {
+    str += t.word() + " ";
+    for (std::size_t j = 0; j < depth; ++j)
+    {
+      str += "[M8[ + " + std::to_string(t.num(10)) + " ";
+    }
+    str += "0";
+    for (std::size_t j = 0; j < depth; ++j)
+    {
+      str += " ]8M]";
+    }
+    str += "\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void defs(Corpus& c, std::size_t scale)
+{
+  Text t {4};
+  std::size_t const count {scale * 10000};
+  std::string str;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    auto const name = "d" + std::to_string(i);
+    str += "[M8[ def " + name + " 'bench' '{!wrd}' <" + t.word() + " {1}> ]8M]\n";
+    str += t.word() + " [M8[ " + name + " " + t.word() + " ]8M]\n";
+    str += t.word() + " [M8[ d" + std::to_string(t.num(i + 1)) + " " + t.word() + " ]8M]\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void hooks(Corpus& c, std::size_t scale)
+{
+  Text t {5};
+  std::string str {
+    "[M8[ m8:hook+ b 'foo' 'bar' ]8M]\n"
+    "[M8[ m8:hook+ r '([0-9]+)' '<{1}>' ]8M]\n"
+    "[M8[ m8:hook+ e 'line' 'LINE' ]8M]\n"
+  };
+  for (std::size_t i = 0; i < scale * 50000; ++i)
+  {
+    str += t.line(48) + " [M8[ + " + std::to_string(t.num(100)) + " 1 ]8M]\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void huge(Corpus& c, std::size_t scale)
+{
+  Text t {6};
+  std::string body;
+  while (body.size() < scale * (2ul << 20))
+  {
+    body += t.line(72) + "\n";
+  }
+  std::string arg;
+  while (arg.size() < scale * (1ul << 20))
+  {
+    arg += t.word() + " ";
+  }
+
+  std::string str {"[M8[ def big " + body + " ]8M]\n"};
+  for (std::size_t i = 0; i < 4; ++i)
+  {
+    str += "[M8[ big ]8M]\n";
+    str += "[M8[ sha256 " + arg + "]8M]\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+void includes(Corpus& c, std::size_t scale)
+{
+  Text t {7};
+  std::size_t const depth {7};
+  std::size_t const files {(1ul << depth) - 1};
+
+  // a binary tree of files, where file n includes 2n+1 and 2n+2
+  for (std::size_t n = 0; n < files; ++n)
+  {
+    std::string str;
+    for (std::size_t i = 0; i < scale * 200; ++i)
+    {
+      str += t.line(48) + " [M8[ + " + std::to_string(t.num(100)) + " 1 ]8M]\n";
+    }
+    for (auto const child : {2 * n + 1, 2 * n + 2})
+    {
+      if (child < files)
+      {
+        str += "[M8[ m8:include 'inc_" + std::to_string(child) + ".m8' ]8M]\n";
+      }
+    }
+    c.bytes += write(c.dir / ("inc_" + std::to_string(n) + ".m8"), str);
+  }
+}
+
+void external(Corpus& c, std::size_t scale)
+{
+  Text t {8};
+  write(c.dir / "config.json",
+    "{\"macros\": [{\"name\": \"echo\", \"info\": \"bench\", \"usage\": \"{!all}\", \"regex\": \"{b}{!all}{e}\"}]}\n");
+  c.args = {"--config", "config.json"};
+
+  std::string str;
+  for (std::size_t i = 0; i < scale * 200; ++i)
+  {
+    str += t.word() + " [M8[ echo " + t.word() + " " + std::to_string(i) + " ]8M]\n";
+  }
+  c.bytes += write(c.dir / c.input, str);
+}
+
+struct Scenario
+{
+  std::string name;
+  std::string info;
+  std::function<void(Corpus&, std::size_t)> fn;
+}; // struct Scenario
+
+std::vector<Scenario> const table {
+  {"passthrough", "plain text without macros", passthrough},
+  {"dense", "many single-line macros per line", dense},
+  {"nested", "calls nested 24 deep", nested},
+  {"def", "macro definitions and their uses", defs},
+  {"hooks", "begin, result and end hooks on every line", hooks},
+  {"huge-args", "multi-megabyte def bodies and arguments", huge},
+  {"include", "a tree of m8:include files", includes},
+  {"external", "external macro calls", external},
+};
+
+} // namespace
+
+std::vector<std::string> scenarios()
+{
+  std::vector<std::string> names;
+  for (auto const& e : table)
+  {
+    names.emplace_back(e.name);
+  }
+  return names;
+}
+
+Corpus generate(std::string const& name, fs::path const& dir, std::size_t scale)
+{
+  for (auto const& e : table)
+  {
+    if (e.name != name)
+    {
+      continue;
+    }
+
+    Corpus c;
+    c.name = e.name;
+    c.info = e.info;
+    c.dir = dir / e.name;
+    c.input = e.name == "include" ? "inc_0.m8" : e.name + ".m8";
+    fs::create_directories(c.dir);
+    e.fn(c, scale);
+    return c;
+  }
+
+  throw std::runtime_error("unknown scenario '" + name + "'");
+}
+
+} // namespace Bench
@@ -0,0 +1,37 @@
+#ifndef M8_BENCH_CORPUS_HH
+#define M8_BENCH_CORPUS_HH
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+#include <filesystem>
+
+namespace Bench
+{
+
+// a generated input and how to run m8 on it
+struct Corpus
+{
+  std::string name;
+  std::string info;
+  // directory m8 runs in, all paths are relative to it
+  std::filesystem::path dir;
+  std::string input;
+  // extra m8 arguments
+  std::vector<std::string> args;
+  // total size of the input files
+  std::size_t bytes {0};
+}; // struct Corpus
+
+// names of the available scenarios
+std::vector<std::string> scenarios();
+
+// write the files of a scenario under dir
+// the content only depends on the name and scale
+Corpus generate(std::string const& name, std::filesystem::path const& dir, std::size_t scale);
+
+} // namespace Bench
+
+#endif // M8_BENCH_CORPUS_HH
@@ -0,0 +1,348 @@
+#include "bench/corpus.hh"
+
+#include "ob/string.hh"
+
+#include "lib/parg.hh"
+
+#include "lib/json.hh"
+using Json = nlohmann::json;
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#ifndef M8_BENCH_BIN
+#define M8_BENCH_BIN "m8"
+#endif
+
+int program_options(OB::Parg& pg);
+int start_bench(OB::Parg& pg);
+
+struct Run
+{
+  double time {0};
+  long rss {0};
+  std::size_t macros {0};
+}; // struct Run
+
+struct Result
+{
+  Bench::Corpus corpus;
+  std::vector<double> times;
+  long rss {0};
+  std::size_t macros {0};
+}; // struct Result
+
+int program_options(OB::Parg& pg)
+{
+  pg.name("m8-bench").version("0.1.0");
+  pg.description("End-to-end benchmarks for m8 on generated corpora.");
+
+  pg.usage("[--m8 'file'] [--dir 'dir'] [--scale 'n'] [--runs 'n'] [--only 'names'] [--json 'file']");
+  pg.usage("[--list]");
+  pg.usage("[-h|--help]");
+
+  pg.info("Examples", {
+    pg.name(),
+    pg.name() + " --only 'dense,nested' --runs 20",
+    pg.name() + " --scale 4 --json 'bench.json'",
+  });
+
+  pg.set("help,h", "print the help output");
+  pg.set("list", "list the scenarios");
+
+  pg.set("m8", M8_BENCH_BIN, "file", "the m8 executable to run");
+  pg.set("dir", (fs::temp_directory_path() / "m8-bench").string(), "dir", "where the corpora are written");
+  pg.set("scale", "1", "n", "multiply the size of each corpus");
+  pg.set("runs", "10", "n", "timed runs per scenario, after one warmup run");
+  pg.set("only", "", "names", "comma separated scenarios to run");
+  pg.set("json", "", "file", "also write the results as json");
+
+  int status {pg.parse()};
+
+  if (status < 0)
+  {
+    std::cerr << pg.help() << "\n";
+    std::cerr << "Error: " << pg.error() << "\n";
+    return -1;
+  }
+
+  if (pg.get<bool>("help"))
+  {
+    std::cerr << pg.help();
+    return 1;
+  }
+
+  return 0;
+}
+
+namespace
+{
+
+// run m8 once on the corpus, output goes to a file in the corpus dir
+Run run_m8(std::string const& m8, Bench::Corpus const& c)
+{
+  std::vector<std::string> args {m8, c.input, "-o", "out.txt", "--summary"};
+  args.insert(args.end(), c.args.begin(), c.args.end());
+
+  std::vector<char*> argv;
+  for (auto& e : args)
+  {
+    argv.emplace_back(e.data());
+  }
+  argv.emplace_back(nullptr);
+
+  // a run that failed leaves its swap file behind,
+  // which would make every later run fail as well
+  std::error_code ec;
+  fs::remove_all(c.dir / ".m8" / "swp", ec);
+
+  int fd[2];
+  if (pipe(fd) == -1)
+  {
+    throw std::runtime_error("could not create a pipe");
+  }
+
+  auto const start = std::chrono::steady_clock::now();
+
+  pid_t const pid {fork()};
+  if (pid == -1)
+  {
+    throw std::runtime_error("could not fork");
+  }
+
+  if (pid == 0)
+  {
+    int const null {open("/dev/null", O_WRONLY)};
+    dup2(null, STDOUT_FILENO);
+    dup2(fd[1], STDERR_FILENO);
+    close(fd[0]);
+    close(fd[1]);
+    if (chdir(c.dir.c_str()) == -1)
+    {
+      _exit(127);
+    }
+    execv(argv.at(0), argv.data());
+    _exit(127);
+  }
+
+  close(fd[1]);
+
+  // the summary on stderr holds the macro count
+  std::string err;
+  char buf[4096];
+  for (;;)
+  {
+    auto const n = read(fd[0], buf, sizeof(buf));
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    err.append(buf, static_cast<std::size_t>(n));
+  }
+  close(fd[0]);
+
+  int status {0};
+  rusage ru {};
+  while (wait4(pid, &status, 0, &ru) == -1 && errno == EINTR)
+  {
+  }
+
+  auto const stop = std::chrono::steady_clock::now();
+
+  if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    throw std::runtime_error("m8 failed on '" + c.name + "':\n" + err);
+  }
+
+  Run r;
+  r.time = std::chrono::duration<double>(stop - start).count();
+  r.rss = ru.ru_maxrss;
+
+  std::istringstream ss {err};
+  std::string line;
+  while (std::getline(ss, line))
+  {
+    auto const pos = line.find("Total");
+    if (pos != std::string::npos)
+    {
+      r.macros = std::stoul(line.substr(pos + 5));
+      break;
+    }
+  }
+
+  return r;
+}
+
+// nearest rank percentile of sorted values
+double percentile(std::vector<double> const& v, double p)
+{
+  if (v.empty())
+  {
+    return 0;
+  }
+  auto rank = static_cast<std::size_t>(p / 100.0 * static_cast<double>(v.size()) + 0.999999);
+  rank = std::clamp<std::size_t>(rank, 1, v.size());
+  return v.at(rank - 1);
+}
+
+} // namespace
+
+int start_bench(OB::Parg& pg)
+{
+  try
+  {
+    auto names = Bench::scenarios();
+
+    if (pg.get<bool>("list"))
+    {
+      for (auto const& e : names)
+      {
+        std::cout << e << "\n";
+      }
+      return 0;
+    }
+
+    if (! pg.get("only").empty())
+    {
+      names = OB::String::delimit(pg.get("only"), ",");
+    }
+
+    auto const m8 = fs::absolute(pg.get("m8")).string();
+    fs::path const dir {pg.get("dir")};
+    auto const scale = std::stoul(pg.get("scale"));
+    auto const runs = std::stoul(pg.get("runs"));
+
+    if (! fs::exists(m8))
+    {
+      throw std::runtime_error("could not find the m8 executable '" + m8 + "'");
+    }
+
+    std::vector<Result> results;
+
+    std::cout
+    << std::left << std::setw(13) << "scenario"
+    << std::right
+    << std::setw(10) << "input MB"
+    << std::setw(10) << "macros"
+    << std::setw(10) << "p50 ms"
+    << std::setw(10) << "p90 ms"
+    << std::setw(10) << "p99 ms"
+    << std::setw(10) << "MB/s"
+    << std::setw(12) << "macros/s"
+    << std::setw(10) << "RSS MB"
+    << "\n";
+
+    for (auto const& name : names)
+    {
+      Result res;
+      res.corpus = Bench::generate(name, dir, scale);
+
+      // warmup, so every timed run sees a warm page cache
+      run_m8(m8, res.corpus);
+
+      for (std::size_t i = 0; i < runs; ++i)
+      {
+        auto const r = run_m8(m8, res.corpus);
+        res.times.emplace_back(r.time);
+        res.rss = std::max(res.rss, r.rss);
+        res.macros = r.macros;
+      }
+      std::sort(res.times.begin(), res.times.end());
+
+      auto const p50 = percentile(res.times, 50);
+      auto const mb = static_cast<double>(res.corpus.bytes) / 1e6;
+
+      std::cout
+      << std::left << std::setw(13) << name
+      << std::right << std::fixed
+      << std::setprecision(2) << std::setw(10) << mb
+      << std::setw(10) << res.macros
+      << std::setprecision(1)
+      << std::setw(10) << percentile(res.times, 50) * 1e3
+      << std::setw(10) << percentile(res.times, 90) * 1e3
+      << std::setw(10) << percentile(res.times, 99) * 1e3
+      << std::setw(10) << mb / p50
+      << std::setprecision(0)
+      << std::setw(12) << static_cast<double>(res.macros) / p50
+      << std::setprecision(1)
+      << std::setw(10) << static_cast<double>(res.rss) / 1024.0
+      << "\n" << std::flush;
+
+      results.emplace_back(std::move(res));
+    }
+
+    if (! pg.get("json").empty())
+    {
+      Json j;
+      j["m8"] = m8;
+      j["scale"] = scale;
+      j["runs"] = runs;
+      j["scenarios"] = Json::array();
+
+      for (auto const& e : results)
+      {
+        auto const p50 = percentile(e.times, 50);
+        j["scenarios"].push_back({
+          {"name", e.corpus.name},
+          {"info", e.corpus.info},
+          {"bytes", e.corpus.bytes},
+          {"macros", e.macros},
+          {"times", e.times},
+          {"p50", p50},
+          {"p90", percentile(e.times, 90)},
+          {"p99", percentile(e.times, 99)},
+          {"mb_per_sec", static_cast<double>(e.corpus.bytes) / 1e6 / p50},
+          {"macros_per_sec", static_cast<double>(e.macros) / p50},
+          {"peak_rss_kb", e.rss},
+        });
+      }
+
+      std::ofstream file {pg.get("json")};
+      if (! file.is_open())
+      {
+        throw std::runtime_error("could not open the json file");
+      }
+      file << j.dump(2) << "\n";
+    }
+
+    return 0;
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  OB::Parg pg {argc, argv};
+  int pstatus {program_options(pg)};
+  if (pstatus > 0) return 0;
+  if (pstatus < 0) return 1;
+
+  return start_bench(pg);
+}
@@ -0,0 +1,445 @@
+#include "ob/string.hh"
+#include "ob/scoped_map.hh"
+#include "ob/crypto.hh"
+
+#include "lib/parg.hh"
+
+#include "lib/json.hh"
+using Json = nlohmann::json;
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+int program_options(OB::Parg& pg);
+int start_bench(OB::Parg& pg);
+
+// one primitive at one input size
+struct Case
+{
+  std::string name;
+  // bytes of input, or entries for the map cases
+  std::size_t size {0};
+  bool bytes {true};
+  // runs the primitive once on input prepared ahead of time
+  std::function<void()> fn;
+}; // struct Case
+
+struct Result
+{
+  std::string name;
+  std::size_t size {0};
+  bool bytes {true};
+  std::size_t iterations {0};
+  // nanoseconds per call of each sample, sorted
+  std::vector<double> samples;
+}; // struct Result
+
+// keeps the compiler from dropping a result that is never read
+template<typename T>
+void keep(T const& val)
+{
+  asm volatile("" : : "g"(&val) : "memory");
+}
+
+int program_options(OB::Parg& pg)
+{
+  pg.name("ob-bench").version("0.1.0");
+  pg.description("Micro-benchmarks for the OB primitives used by m8 macros.");
+
+  pg.usage("[--sizes 'n,n'] [--samples 'n'] [--min-time 'ms'] [--only 'names'] [--json 'file']");
+  pg.usage("[--list]");
+  pg.usage("[-h|--help]");
+
+  pg.info("Examples", {
+    pg.name(),
+    pg.name() + " --only 'replace_all,xformat' --sizes '1024,65536'",
+    pg.name() + " --samples 30 --json 'ob-bench.json'",
+  });
+
+  pg.set("help,h", "print the help output");
+  pg.set("list", "list the primitives");
+
+  pg.set("sizes", "64,1024,16384", "n,n", "comma separated input sizes in bytes or map entries");
+  pg.set("samples", "10", "n", "timed samples per case, after one warmup sample");
+  pg.set("min-time", "20", "ms", "minimum time of a sample, which sets the iterations per sample");
+  pg.set("only", "", "names", "comma separated primitives to run");
+  pg.set("json", "", "file", "also write the results as json");
+
+  int status {pg.parse()};
+
+  if (status < 0)
+  {
+    std::cerr << pg.help() << "\n";
+    std::cerr << "Error: " << pg.error() << "\n";
+    return -1;
+  }
+
+  if (pg.get<bool>("help"))
+  {
+    std::cerr << pg.help();
+    return 1;
+  }
+
+  return 0;
+}
+
+namespace
+{
+
+// text of about size bytes, with piece repeated between random words
+std::string text(std::size_t size, std::string const& piece, std::size_t every)
+{
+  std::mt19937 rng {8};
+  std::uniform_int_distribution<int> len {2, 8};
+  std::uniform_int_distribution<int> chr {'a', 'z'};
+
+  std::string str;
+  str.reserve(size + piece.size() + 8);
+  std::size_t next {every};
+  while (str.size() < size)
+  {
+    if (str.size() >= next)
+    {
+      str += piece;
+      next += every;
+    }
+    for (auto n = len(rng); n > 0; --n)
+    {
+      str += static_cast<char>(chr(rng));
+    }
+    str += ' ';
+  }
+  str.resize(size);
+
+  return str;
+}
+
+std::vector<std::string> primitives()
+{
+  return {
+    "format",
+    "xformat",
+    "replace_all",
+    "unescape",
+    "split",
+    "scoped_map:insert",
+    "scoped_map:find",
+    "scoped_map:scope",
+    "sha256",
+  };
+}
+
+// the input is built once and captured, only the call itself is timed
+Case make_case(std::string const& name, std::size_t size)
+{
+  Case c;
+  c.name = name;
+  c.size = size;
+
+  if (name == "format")
+  {
+    auto const str = text(size, "{name}", 32);
+    std::unordered_map<std::string, std::string> const args {{"name", "octobanana"}};
+    c.fn = [=]() {
+      keep(OB::String::format(str, args));
+    };
+  }
+  else if (name == "xformat")
+  {
+    // the expansion of a def macro body
+    auto const str = text(size, "{1}", 32);
+    std::unordered_map<std::string, std::string> const args {{"0", "octobanana"}, {"1", "octobanana"}};
+    c.fn = [=]() {
+      keep(OB::String::xformat(str, args));
+    };
+  }
+  else if (name == "replace_all")
+  {
+    // the unescaping of delimiters in a def macro body
+    auto const str = text(size, "`[M8[", 64);
+    c.fn = [=]() {
+      keep(OB::String::replace_all(str, "`[M8[", "[M8["));
+    };
+  }
+  else if (name == "unescape")
+  {
+    auto const str = text(size, "\\n\\t", 32);
+    c.fn = [=]() {
+      keep(OB::String::unescape(str));
+    };
+  }
+  else if (name == "split")
+  {
+    auto const str = text(size, "", size + 1);
+    c.fn = [=]() {
+      keep(OB::String::split(str, " "));
+    };
+  }
+  else if (name.rfind("scoped_map:", 0) == 0)
+  {
+    c.bytes = false;
+
+    std::vector<std::string> keys;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      keys.emplace_back("macro_" + std::to_string(i));
+    }
+
+    if (name == "scoped_map:insert")
+    {
+      // fill a new map, as the macro table is at startup
+      c.fn = [keys]() {
+        OB::Scoped_Map<std::string, std::string> map;
+        for (auto const& e : keys)
+        {
+          map(e, e);
+        }
+        keep(map);
+      };
+    }
+    else if (name == "scoped_map:find")
+    {
+      auto map = std::make_shared<OB::Scoped_Map<std::string, std::string>>();
+      for (auto const& e : keys)
+      {
+        (*map)(e, e);
+      }
+      c.fn = [keys, map]() {
+        std::size_t n {0};
+        for (auto const& e : keys)
+        {
+          n += map->find(e) != map->end();
+        }
+        keep(n);
+      };
+    }
+    else
+    {
+      // enter a namespace block, define every key in it, then leave it
+      auto map = std::make_shared<OB::Scoped_Map<std::string, std::string>>();
+      c.fn = [keys, map]() {
+        map->add_scope();
+        for (auto const& e : keys)
+        {
+          (*map)(e, e);
+        }
+        map->rm_scope();
+      };
+    }
+  }
+  else if (name == "sha256")
+  {
+    auto const str = text(size, "", size + 1);
+    c.fn = [=]() {
+      keep(OB::Crypto::sha256(str));
+    };
+  }
+  else
+  {
+    throw std::runtime_error("unknown primitive '" + name + "'");
+  }
+
+  return c;
+}
+
+// time one sample of iters calls, in nanoseconds per call
+double sample(Case const& c, std::size_t iters)
+{
+  auto const start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iters; ++i)
+  {
+    c.fn();
+  }
+  auto const stop = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(stop - start).count() / static_cast<double>(iters);
+}
+
+Result run_case(Case const& c, std::size_t samples, double min_time)
+{
+  Result r;
+  r.name = c.name;
+  r.size = c.size;
+  r.bytes = c.bytes;
+
+  // double the iterations until one sample takes at least min_time,
+  // the same count is then used for every sample
+  std::size_t iters {1};
+  for (;;)
+  {
+    auto const ns = sample(c, iters) * static_cast<double>(iters);
+    if (ns >= min_time || iters >= (std::size_t {1} << 30))
+    {
+      break;
+    }
+    iters *= 2;
+  }
+  r.iterations = iters;
+
+  // warmup
+  sample(c, iters);
+
+  for (std::size_t i = 0; i < samples; ++i)
+  {
+    r.samples.emplace_back(sample(c, iters));
+  }
+  std::sort(r.samples.begin(), r.samples.end());
+
+  return r;
+}
+
+// nearest rank percentile of sorted values
+double percentile(std::vector<double> const& v, double p)
+{
+  if (v.empty())
+  {
+    return 0;
+  }
+  auto rank = static_cast<std::size_t>(p / 100.0 * static_cast<double>(v.size()) + 0.999999);
+  rank = std::clamp<std::size_t>(rank, 1, v.size());
+  return v.at(rank - 1);
+}
+
+// MB/s for byte sized cases, million items/s for the map cases
+double rate(Result const& r)
+{
+  return static_cast<double>(r.size) / percentile(r.samples, 50) * 1e3;
+}
+
+} // namespace
+
+int start_bench(OB::Parg& pg)
+{
+  try
+  {
+    auto names = primitives();
+
+    if (pg.get<bool>("list"))
+    {
+      for (auto const& e : names)
+      {
+        std::cout << e << "\n";
+      }
+      return 0;
+    }
+
+    if (! pg.get("only").empty())
+    {
+      names = OB::String::delimit(pg.get("only"), ",");
+    }
+
+    std::vector<std::size_t> sizes;
+    for (auto const& e : OB::String::delimit(pg.get("sizes"), ","))
+    {
+      sizes.emplace_back(std::stoul(e));
+    }
+    auto const samples = std::stoul(pg.get("samples"));
+    auto const min_time = std::stod(pg.get("min-time")) * 1e6;
+
+    std::vector<Result> results;
+
+    std::cout
+    << std::left << std::setw(20) << "primitive"
+    << std::right
+    << std::setw(10) << "size"
+    << std::setw(12) << "iters"
+    << std::setw(14) << "p10 ns"
+    << std::setw(14) << "p50 ns"
+    << std::setw(14) << "p90 ns"
+    << std::setw(12) << "MB/s|M/s"
+    << "\n";
+
+    for (auto const& name : names)
+    {
+      for (auto const& size : sizes)
+      {
+        auto const c = make_case(name, size);
+        auto r = run_case(c, samples, min_time);
+
+        std::cout
+        << std::left << std::setw(20) << r.name
+        << std::right << std::fixed
+        << std::setw(10) << r.size
+        << std::setw(12) << r.iterations
+        << std::setprecision(1)
+        << std::setw(14) << percentile(r.samples, 10)
+        << std::setw(14) << percentile(r.samples, 50)
+        << std::setw(14) << percentile(r.samples, 90)
+        << std::setprecision(2)
+        << std::setw(12) << rate(r)
+        << "\n" << std::flush;
+
+        results.emplace_back(std::move(r));
+      }
+    }
+
+    if (! pg.get("json").empty())
+    {
+      Json j;
+      j["samples"] = samples;
+      j["min_time_ms"] = min_time / 1e6;
+      j["results"] = Json::array();
+
+      for (auto const& e : results)
+      {
+        Json r {
+          {"name", e.name},
+          {"size", e.size},
+          {"unit", e.bytes ? "bytes" : "entries"},
+          {"iterations", e.iterations},
+          {"ns", e.samples},
+          {"p10_ns", percentile(e.samples, 10)},
+          {"p50_ns", percentile(e.samples, 50)},
+          {"p90_ns", percentile(e.samples, 90)},
+        };
+        if (e.bytes)
+        {
+          r["mb_per_sec"] = rate(e);
+        }
+        else
+        {
+          r["m_entries_per_sec"] = rate(e);
+        }
+        j["results"].push_back(r);
+      }
+
+      std::ofstream file {pg.get("json")};
+      if (! file.is_open())
+      {
+        throw std::runtime_error("could not open the json file");
+      }
+      file << j.dump(2) << "\n";
+    }
+
+    return 0;
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  OB::Parg pg {argc, argv};
+  int pstatus {program_options(pg)};
+  if (pstatus > 0) return 0;
+  if (pstatus < 0) return 1;
+
+  return start_bench(pg);
+}
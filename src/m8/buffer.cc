@@ -0,0 +1,119 @@
+#include "m8/buffer.hh"
+
+#include <cstddef>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <utility>
+
+Buffer::Buffer()
+{
+}
+
+Buffer::~Buffer()
+{
+}
+
+void Buffer::view(std::string_view str)
+{
+  if (str.empty())
+  {
+    return;
+  }
+
+  spans_.emplace_back(str);
+  size_ += str.size();
+}
+
+void Buffer::copy(std::string_view str)
+{
+  if (str.empty())
+  {
+    return;
+  }
+
+  // deque elements keep their address as it grows
+  spans_.emplace_back(strs_.emplace_back(str));
+  size_ += str.size();
+}
+
+std::size_t Buffer::slot()
+{
+  spans_.emplace_back();
+  return spans_.size() - 1;
+}
+
+void Buffer::fill(std::size_t idx, std::string_view str)
+{
+  if (str.empty())
+  {
+    return;
+  }
+
+  spans_.at(idx) = strs_.emplace_back(str);
+  size_ += str.size();
+}
+
+void Buffer::own()
+{
+  // spans keep their index, so reserved spans can still be filled
+  std::deque<std::string> strs;
+  for (auto& e : spans_)
+  {
+    if (! e.empty())
+    {
+      e = strs.emplace_back(e);
+    }
+  }
+  strs_ = std::move(strs);
+}
+
+void Buffer::clear()
+{
+  spans_.clear();
+  strs_.clear();
+  size_ = 0;
+}
+
+bool Buffer::empty() const
+{
+  return size_ == 0;
+}
+
+std::size_t Buffer::size() const
+{
+  return size_;
+}
+
+char Buffer::back() const
+{
+  for (auto it = spans_.rbegin(); it != spans_.rend(); ++it)
+  {
+    if (! it->empty())
+    {
+      return it->back();
+    }
+  }
+
+  return '\0';
+}
+
+std::string Buffer::str() const
+{
+  std::string str;
+  str.reserve(size_);
+
+  for (auto const& e : spans_)
+  {
+    str += e;
+  }
+
+  return str;
+}
+
+std::vector<std::string_view> const& Buffer::spans() const
+{
+  return spans_;
+}
@@ -0,0 +1,59 @@
+#ifndef M8_BUFFER_HH
+#define M8_BUFFER_HH
+
+#include <cstddef>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+
+// output of a single line as a list of spans
+// plain text is referenced in place, macro results are owned
+class Buffer
+{
+public:
+
+  Buffer();
+  ~Buffer();
+
+  // a copy would reference the storage of the original,
+  // a move keeps the owned text in place
+  Buffer(Buffer const&) = delete;
+  Buffer& operator=(Buffer const&) = delete;
+  Buffer(Buffer&&) = default;
+  Buffer& operator=(Buffer&&) = default;
+
+  // reference text owned by the caller
+  // it must stay valid until the buffer is cleared
+  void view(std::string_view str);
+
+  // copy text into storage owned by the buffer
+  void copy(std::string_view str);
+
+  // reserve a span for text that is not known yet, returns its index
+  std::size_t slot();
+
+  // copy text into a reserved span
+  void fill(std::size_t idx, std::string_view str);
+
+  // copy the spans referenced in place into storage,
+  // so the buffer outlives the text it was built from
+  void own();
+
+  void clear();
+  bool empty() const;
+  std::size_t size() const;
+  // last char, or nul when empty
+  char back() const;
+  std::string str() const;
+  std::vector<std::string_view> const& spans() const;
+
+private:
+
+  std::vector<std::string_view> spans_;
+  std::deque<std::string> strs_;
+  std::size_t size_ {0};
+}; // class Buffer
+
+#endif // M8_BUFFER_HH
@@ -0,0 +1,230 @@
+#include "m8/cache.hh"
+
+#include "ob/crypto.hh"
+
+#include "lib/json.hh"
+using Json = nlohmann::json;
+
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <optional>
+#include <mutex>
+#include <utility>
+#include <stdexcept>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+Cache::Cache()
+{
+}
+
+Cache::~Cache()
+{
+  try
+  {
+    save();
+  }
+  catch (...)
+  {
+  }
+}
+
+std::string Cache::key(std::string const& name, std::string const& method,
+  std::string const& url, std::string const& data)
+{
+  std::string str {name};
+  for (auto const& e : {method, url, data})
+  {
+    str += '\0';
+    str += e;
+  }
+  return OB::Crypto::sha256(str);
+}
+
+void Cache::load(std::string const& file_name)
+{
+  std::lock_guard<std::mutex> lock {mtx_};
+  if (file_ == file_name)
+  {
+    return;
+  }
+  file_ = file_name;
+
+  for (auto& [key, val] : read())
+  {
+    db_.insert_or_assign(key, std::move(val));
+  }
+}
+
+std::unordered_map<std::string, Cache::Entry> Cache::read() const
+{
+  std::unordered_map<std::string, Entry> db;
+
+  std::ifstream file {file_};
+  if (! file.is_open())
+  {
+    return db;
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+
+  // a damaged file is started over
+  Json j;
+  try
+  {
+    j = Json::parse(ss.str());
+  }
+  catch (std::exception const&)
+  {
+    return db;
+  }
+  if (! j.is_object())
+  {
+    return db;
+  }
+
+  for (auto it = j.begin(); it != j.end(); ++it)
+  {
+    auto const& e = it.value();
+    Entry entry;
+    entry.val = e.value("val", "");
+    entry.time = e.value("time", std::int64_t {0});
+    entry.etag = e.value("etag", "");
+    entry.last_modified = e.value("last_modified", "");
+    db.emplace(it.key(), std::move(entry));
+  }
+
+  return db;
+}
+
+void Cache::save()
+{
+  std::lock_guard<std::mutex> lock {mtx_};
+  if (file_.empty())
+  {
+    return;
+  }
+
+  fs::path const path {file_};
+  if (! path.parent_path().empty())
+  {
+    fs::create_directories(path.parent_path());
+  }
+
+  // other processes save to the same file,
+  // the lock keeps their merges from interleaving
+  int const fd {open((file_ + ".lock").c_str(), O_CREAT | O_RDWR, 0644)};
+  if (fd < 0)
+  {
+    throw std::runtime_error("could not open the cache lock file");
+  }
+  flock(fd, LOCK_EX);
+
+  // keep the newer of each entry
+  auto db = read();
+  for (auto const& [key, val] : db_)
+  {
+    auto const it = db.find(key);
+    if (it == db.end() || it->second.time <= val.time)
+    {
+      db.insert_or_assign(key, val);
+    }
+  }
+
+  // entries unused by this run are dropped once no ttl can make them fresh
+  auto const now = static_cast<std::int64_t>(std::time(nullptr));
+  for (auto it = db.begin(); it != db.end();)
+  {
+    auto const e = db_.find(it->first);
+    bool const used {e != db_.end() && (e->second.run || e->second.used)};
+    if (! used && now - it->second.time >= keep_)
+    {
+      it = db.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  Json j = Json::object();
+  for (auto const& [key, val] : db)
+  {
+    Json e {
+      {"val", val.val},
+      {"time", val.time},
+      {"etag", val.etag},
+      {"last_modified", val.last_modified},
+    };
+
+    // values that are not valid utf-8 can not be stored as json
+    try
+    {
+      e.dump();
+    }
+    catch (std::exception const&)
+    {
+      continue;
+    }
+    j[key] = std::move(e);
+  }
+
+  auto const tmp = file_ + ".tmp-" + std::to_string(getpid());
+  {
+    std::ofstream file {tmp};
+    if (! file.is_open())
+    {
+      flock(fd, LOCK_UN);
+      close(fd);
+      throw std::runtime_error("could not write the cache file");
+    }
+    file << j.dump();
+  }
+  fs::rename(tmp, file_);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+bool Cache::fresh(Entry const& entry, std::int64_t ttl)
+{
+  return entry.run || static_cast<std::int64_t>(std::time(nullptr)) - entry.time < ttl;
+}
+
+void Cache::keep(std::int64_t ttl)
+{
+  std::lock_guard<std::mutex> lock {mtx_};
+  keep_ = ttl;
+}
+
+std::optional<Cache::Entry> Cache::get(std::string const& key)
+{
+  std::lock_guard<std::mutex> lock {mtx_};
+  auto const it = db_.find(key);
+  if (it == db_.end())
+  {
+    return {};
+  }
+  it->second.used = true;
+  return it->second;
+}
+
+void Cache::set(std::string const& key, Entry entry)
+{
+  entry.time = static_cast<std::int64_t>(std::time(nullptr));
+  entry.run = true;
+
+  std::lock_guard<std::mutex> lock {mtx_};
+  db_.insert_or_assign(key, std::move(entry));
+}
@@ -1,105 +1,79 @@
 #ifndef M8_CACHE_HH
 #define M8_CACHE_HH
 
-#include <boost/serialization/map.hpp>
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
+#include <cstdint>
+#include <cstddef>
 
 #include <string>
-#include <vector>
-#include <iostream>
-#include <fstream>
-#include <map>
-#include <filesystem>
-
+#include <unordered_map>
+#include <optional>
+#include <atomic>
+#include <mutex>
+
+// responses of remote macros and http requests, kept for the run,
+// and written to a file when one is loaded
+// every member is safe to call from many threads
 class Cache
 {
-  namespace fs = std::filesystem;
-
 public:
 
-  Cache(std::string file_name {}) :
-  file_name_ {file_name}
-  {
-    fs::path path {file_name_};
-    std::string filename {path.filename()};
-
-    if (filename.empty())
-    {
-      filename = "readline";
-    }
-    if (filename.at(0) == '.')
-    {
-      file_lock_ = "./.m8/" + filename + ".lock.m8";
-      file_cache_ = "./.m8/" + filename + ".cache.m8";
-    }
-    else
-    {
-      file_lock_ = "./.m8/." + filename + ".lock.m8";
-      file_cache_ = "./.m8/." + filename + ".cache.m8";
-    }
-
-    lock();
-    load();
-  }
-
-  ~Cache()
+  struct Entry
   {
-    save();
-    unlock();
-  }
+    std::string val;
+    // seconds since the epoch, when it was stored or revalidated
+    std::int64_t time {0};
+    // validators sent back to revalidate the entry
+    std::string etag;
+    std::string last_modified;
+    // stored during this run, which is not written to the file
+    bool run {false};
+    // read during this run
+    bool used {false};
+  }; // struct Entry
 
-  bool get(std::string const& key, std::string& val)
-  {
-    if (db_.find(key) == db_.end())
-    {
-      return false;
-    }
-    val = db_[key];
-    return true;
-  }
-
-  void set(std::string const& key, std::string const& val)
-  {
-    db_[key] = val;
-  }
+  Cache();
+  ~Cache();
 
-private:
+  Cache(Cache const&) = delete;
+  Cache& operator=(Cache const&) = delete;
 
-  void lock()
-  {
-    if (fs::exists(file_lock_))
-    {
-      throw std::runtime_error("cache lock file already in use");
-    }
-    std::ofstream file_lock {file_lock_};
-    file_lock.close();
-  }
-
-  void unlock()
-  {
-    fs::remove(file_lock_);
-  }
+  // the key of a request, the name is the macro making it
+  static std::string key(std::string const& name, std::string const& method,
+    std::string const& url, std::string const& data);
 
-  void load()
-  {
-    if (! fs::exists(file_cache_)) return;
-    std::ifstream icache {file_cache_, std::ios::binary};
-    boost::archive::binary_iarchive iarch(icache);
-    iarch >> db_;
-  }
+  // read the entries of a file, the cache is written back to it when destroyed
+  void load(std::string const& file_name);
 
-  void save()
-  {
-    std::ofstream ocache {file_cache_, std::ios::binary};
-    boost::archive::binary_oarchive oarch(ocache);
-    oarch << db_;
-  }
-
-  std::string const file_name_;
-  std::string file_lock_;
-  std::string file_cache_;
-  std::map<std::string, std::string> db_;
+  // merge the cache with the entries in its file and write it back,
+  // dropping the ones this run did not use that are older than the keep ttl
+  void save();
+
+  // the largest ttl in seconds of any macro, older entries are only kept when used
+  void keep(std::int64_t ttl);
+
+  // entries stored during this run stay fresh until it ends,
+  // older ones while younger than ttl seconds
+  static bool fresh(Entry const& entry, std::int64_t ttl);
+
+  std::optional<Entry> get(std::string const& key);
+
+  // store an entry as of now
+  void set(std::string const& key, Entry entry);
+
+  // requests answered from the cache, answered after a revalidation,
+  // and sent without a usable entry
+  std::atomic<std::size_t> hits {0};
+  std::atomic<std::size_t> revalidations {0};
+  std::atomic<std::size_t> misses {0};
+
+private:
+
+  std::unordered_map<std::string, Entry> read() const;
+
+  mutable std::mutex mtx_;
+  std::unordered_map<std::string, Entry> db_;
+  std::string file_;
+  std::int64_t keep_ {0};
 }; // class Cache
 
 #endif // M8_CACHE_HH
@@ -1,7 +1,12 @@
 #include "m8/m8.hh"
 
 #include "m8/ast.hh"
+#include "m8/buffer.hh"
+#include "m8/cache.hh"
+#include "m8/mem_stats.hh"
+#include "m8/skeleton.hh"
 #include "m8/reader.hh"
+#include "m8/scanner.hh"
 #include "m8/writer.hh"
 
 #include "ob/sys_command.hh"
@@ -14,11 +19,15 @@ namespace aec = OB::Term::ANSI_Escape_Codes;
 #include "lib/json.hh"
 using Json = nlohmann::json;
 
+#include <sys/resource.h>
+
 #include <ctime>
 #include <cctype>
+#include <cstdint>
 #include <cstddef>
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
@@ -35,6 +44,7 @@ using Json = nlohmann::json;
 #include <future>
 #include <iterator>
 #include <stack>
+#include <utility>
 #include <algorithm>
 #include <deque>
 #include <optional>
@@ -73,6 +83,7 @@ void M8::core_macros()
       }
       includes_.emplace(name);
 
+      ++stats_.include;
       ctx.core->w.write(ctx.core->buf);
       ctx.core->w.flush();
       ctx.core->buf.clear();
@@ -98,6 +109,7 @@ void M8::core_macros()
     }
     try
     {
+      ++stats_.include;
       ctx.core->w.write(ctx.core->buf);
       ctx.core->w.flush();
       ctx.core->buf.clear();
@@ -462,6 +474,86 @@ void M8::set_debug(bool val)
   settings_.debug = val;
 }
 
+void M8::set_profile(bool val)
+{
+  settings_.profile = val;
+}
+
+void M8::set_trace(std::string const& file_name)
+{
+  tracer_.open_trace(file_name);
+}
+
+void M8::set_trace_folded(std::string const& file_name)
+{
+  tracer_.open_folded(file_name);
+}
+
+void M8::set_mem_stats(bool val)
+{
+  if (val)
+  {
+    Mem_Stats::enable();
+  }
+}
+
+void M8::set_async(std::size_t val)
+{
+  settings_.async = val;
+}
+
+void M8::set_cache(bool val)
+{
+  settings_.cache = val;
+}
+
+void M8::set_batch_compile(bool val)
+{
+  settings_.batch_compile = val;
+}
+
+void M8::set_exit_status(bool val)
+{
+  settings_.exit_status = val;
+}
+
+bool M8::exit_status() const
+{
+  return settings_.exit_status;
+}
+
+Manifest& M8::manifest()
+{
+  return manifest_;
+}
+
+void M8::share(M8 const& other)
+{
+  cache_ = other.cache_;
+  coprocs_ = other.coprocs_;
+}
+
+void M8::keep()
+{
+  base_ = std::make_unique<Base>(Base {macros_, h_begin_, h_macro_, h_res_, h_end_, manifest_});
+}
+
+void M8::reset()
+{
+  if (base_)
+  {
+    macros_ = base_->macros;
+    h_begin_ = base_->h_begin;
+    h_macro_ = base_->h_macro;
+    h_res_ = base_->h_res;
+    h_end_ = base_->h_end;
+    manifest_ = base_->manifest;
+  }
+  includes_.clear();
+  stats_ = Stats();
+  ast_.clear();
+}
+
 void M8::set_comment(std::string str)
 {
   comment_ = str;
@@ -470,6 +562,7 @@ void M8::set_comment(std::string str)
 void M8::set_ignore(std::string str)
 {
   ignore_ = str;
+  rx_ignore_ = compile_regex(ignore_);
 }
 
 void M8::set_copy(bool val)
@@ -482,43 +575,139 @@ void M8::set_readline(bool val)
   settings_.readline = val;
 }
 
+void M8::set_template_cache(bool val)
+{
+  settings_.template_cache = val;
+}
+
+std::regex M8::compile_regex(std::string const& str)
+{
+  Mem_Stats::Scope const mem {"regex"};
+  ++stats_.regex;
+
+  return std::regex(str);
+}
+
+void M8::compile_macro(macro_t& macro)
+{
+  // patterns built only from grammar tokens use the linear matcher
+  bool const linear {macro.matcher.compile(macro.regex)};
+
+  macro.regex = OB::String::format(macro.regex, rx_grammar_);
+
+  // an empty regex uses the built-in argument validation
+  if (! linear && ! macro.regex.empty())
+  {
+    macro.rx = compile_regex(macro.regex);
+  }
+}
+
+bool M8::match_macro(macro_t const& macro, std::string const& str, Args& res) const
+{
+  if (! macro.matcher.empty())
+  {
+    return macro.matcher.match(str, res);
+  }
+
+  std::smatch match;
+  if (! std::regex_match(str, match, macro.rx))
+  {
+    return false;
+  }
+
+  for (auto const& e : match)
+  {
+    res.emplace_back(std::string(e));
+  }
+
+  return true;
+}
+
+bool M8::split_macro(std::string const& str, std::string& name, std::string& args) const
+{
+  // equivalent to '^\s*([^\s]+)\s*([^\r]*?)\s*$' in a single pass
+  std::string const ws {" \t\n\v\f\r"};
+
+  auto const name_begin = str.find_first_not_of(ws);
+  if (name_begin == std::string::npos)
+  {
+    return false;
+  }
+
+  auto name_end = str.find_first_of(ws, name_begin);
+  if (name_end == std::string::npos)
+  {
+    name_end = str.size();
+  }
+
+  auto args_begin = str.find_first_not_of(ws, name_end);
+  if (args_begin == std::string::npos)
+  {
+    args_begin = str.size();
+  }
+
+  auto args_end = str.find_last_not_of(ws);
+  if (args_end == std::string::npos || args_end < args_begin)
+  {
+    args_end = args_begin;
+  }
+  else
+  {
+    ++args_end;
+  }
+
+  if (str.find('\r', args_begin) < args_end)
+  {
+    return false;
+  }
+
+  name = str.substr(name_begin, name_end - name_begin);
+  args = str.substr(args_begin, args_end - args_begin);
+
+  return true;
+}
+
 void M8::set_core(std::string const& name, std::string const& info,
   std::string const& usage, std::string regex, macro_fn func)
 {
-  regex = OB::String::format(regex, rx_grammar_);
+  macro_t macro {usage, regex, func};
+  compile_macro(macro);
 
-  macros_.insert_or_assign(name, Macro({Mtype::core, name, info, {{usage, regex, func}}, {}}));
+  macros_.insert_or_assign(name, Macro({Mtype::core, name, info, {macro}, {}}));
 }
 
 void M8::set_macro(std::string const& name, std::string const& info,
-  std::string const& usage, std::string regex)
+  std::string const& usage, std::string regex, Xmode mode)
 {
-  regex = OB::String::format(regex, rx_grammar_);
+  macro_t macro {usage, regex, nullptr};
+  compile_macro(macro);
 
-  macros_.insert_or_assign(name, Macro({Mtype::external, name, info, {{usage, regex, nullptr}}, {}}));
+  macros_.insert_or_assign(name, Macro({Mtype::external, name, info, {macro}, {}, false, mode}));
 }
 
 void M8::set_macro(std::string const& name, std::string const& info,
-  std::string const& usage, std::string regex, std::string const& url)
+  std::string const& usage, std::string regex, std::string const& url, bool batch)
 {
-  regex = OB::String::format(regex, rx_grammar_);
+  macro_t macro {usage, regex, nullptr};
+  compile_macro(macro);
 
-  macros_.insert_or_assign(name, Macro({Mtype::remote, name, info, {{usage, regex, nullptr}}, url}));
+  macros_.insert_or_assign(name, Macro({Mtype::remote, name, info, {macro}, url, batch}));
 }
 
 void M8::set_macro(std::string const& name, std::string const& info,
   std::string const& usage, std::string regex, macro_fn func)
 {
-  regex = OB::String::format(regex, rx_grammar_);
+  macro_t macro {usage, regex, func};
+  compile_macro(macro);
 
-  macros_.insert_or_assign(name, Macro({Mtype::internal, name, info, {{usage, regex, func}}, {}}));
+  macros_.insert_or_assign(name, Macro({Mtype::internal, name, info, {macro}, {}}));
 }
 
 void M8::set_macro(std::string const& name, std::string const& info, std::vector<M8::macro_t> impl)
 {
   for (auto& e : impl)
   {
-    e.regex = OB::String::format(e.regex, rx_grammar_);
+    compile_macro(e);
   }
 
   if (auto it = macros_.find(name); it != macros_.end())
@@ -550,6 +739,15 @@ void M8::set_macro(std::string const& name, std::string const& info, std::vector
   }
 }
 
+void M8::set_batch(std::string const& name, group_fn group, batch_fn run)
+{
+  if (auto it = macros_.find(name); it != macros_.end())
+  {
+    it->second.group = group;
+    it->second.run = run;
+  }
+}
+
 void M8::unset_macro(std::string const& name)
 {
   macros_.erase(name);
@@ -681,6 +879,9 @@ void M8::set_config(std::string file_name)
     file_name = env_var("HOME") + "/.m8.json";
   }
 
+  // a config file that appears later also changes the output
+  manifest_.file(file_name);
+
   // open the config file
   std::ifstream file {file_name};
   if (! file.is_open())
@@ -701,8 +902,49 @@ void M8::set_config(std::string file_name)
 
   // parse the contents
   Json j = Json::parse(content);
+
+  // response cache, off with false, or an object of its settings
+  if (j.count("cache") == 1)
+  {
+    auto const& e = j["cache"];
+    if (e.is_boolean())
+    {
+      settings_.cache = e.get<bool>();
+    }
+    else
+    {
+      if (e.count("ttl") == 1)
+      {
+        settings_.cache_ttl = e["ttl"].get<std::int64_t>();
+      }
+      if (e.count("post") == 1)
+      {
+        settings_.cache_post = e["post"].get<bool>();
+      }
+      if (e.count("disk") == 1 && e["disk"].get<bool>())
+      {
+        cache_->load(".m8/cache.json");
+      }
+    }
+  }
+
   for (auto const& e : j["macros"])
   {
+    // cache settings of the macro
+    if (e.count("cache") == 1 || e.count("ttl") == 1)
+    {
+      Cache_Policy policy;
+      if (e.count("cache") == 1)
+      {
+        policy.use = e["cache"].get<bool>();
+      }
+      if (e.count("ttl") == 1)
+      {
+        policy.ttl = e["ttl"].get<std::int64_t>();
+      }
+      cache_policy_.insert_or_assign(e["name"].get<std::string>(), policy);
+    }
+
     // add remote macro
     if (e.count("url") == 1)
     {
@@ -711,19 +953,68 @@ void M8::set_config(std::string file_name)
         e["info"].get<std::string>(),
         e["usage"].get<std::string>(),
         e["regex"].get<std::string>(),
-        e["url"].get<std::string>());
+        e["url"].get<std::string>(),
+        e.count("batch") == 1 && e["batch"].get<bool>());
     }
 
     // add external macro
     else
     {
+      // run once per call, directly or with the shell,
+      // or started once as a coprocess
+      Xmode mode {Xmode::exec};
+      if (e.count("mode") == 1)
+      {
+        auto const str = e["mode"].get<std::string>();
+        if (str == "shell")
+        {
+          mode = Xmode::shell;
+        }
+        else if (str == "coprocess")
+        {
+          mode = Xmode::coprocess;
+        }
+        else if (str != "exec")
+        {
+          throw std::runtime_error("macro " + e["name"].get<std::string>() + " has an unknown mode '" + str + "'");
+        }
+      }
+
       set_macro(
         e["name"].get<std::string>(),
         e["info"].get<std::string>(),
         e["usage"].get<std::string>(),
-        e["regex"].get<std::string>());
+        e["regex"].get<std::string>(),
+        mode);
     }
   }
+
+  // entries no ttl can still use are dropped from the file
+  auto ttl = settings_.cache_ttl;
+  for (auto const& [name, policy] : cache_policy_)
+  {
+    ttl = std::max(ttl, policy.ttl);
+  }
+  cache_->keep(ttl);
+}
+
+void M8::add_stats(M8 const& other)
+{
+  auto const& o = other.stats_;
+  stats_.macro += o.macro;
+  stats_.ignored += o.ignored;
+  stats_.warning += o.warning;
+  stats_.error += o.error;
+  stats_.pass += o.pass;
+  stats_.core += o.core;
+  stats_.internal += o.internal;
+  stats_.external += o.external;
+  stats_.remote += o.remote;
+  stats_.regex += o.regex;
+  stats_.include += o.include;
+  stats_.bytes_read += o.bytes_read;
+  stats_.bytes_written += o.bytes_written;
+  stats_.remote_ns.insert(stats_.remote_ns.end(), o.remote_ns.begin(), o.remote_ns.end());
 }
 
 std::string M8::summary() const
@@ -751,10 +1042,124 @@ std::string M8::summary() const
   << OB::Term::iomanip::pop()
   << aec::wrap("passes     ", aec::fg_magenta) << aec::wrap(stats_.pass, aec::fg_green) << "\n"
   << aec::wrap("warnings   ", aec::fg_magenta) << aec::wrap(stats_.warning, aec::fg_green) << "\n"
+  << aec::wrap("regexes    ", aec::fg_magenta) << aec::wrap(stats_.regex, aec::fg_green) << "\n"
   << OB::Term::iomanip::pop();
   return oss.str();
 }
 
+std::string M8::profile() const
+{
+  return profiler_.str();
+}
+
+std::string M8::mem_stats() const
+{
+  return Mem_Stats::str();
+}
+
+std::vector<M8::Metric> M8::metrics(bool failed) const
+{
+  auto const wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+
+  // ru_maxrss is in kilobytes on linux
+  std::uint64_t rss {0};
+  rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+  {
+    rss = static_cast<std::uint64_t>(ru.ru_maxrss) * 1024;
+  }
+
+  auto const num = [](auto const val) {
+    return Json(val).dump();
+  };
+
+  return {
+    {"failed", "1 when the run ended with an error, the other metrics cover the work done until then.", num(failed ? 1 : 0)},
+    {"wall_time_seconds", "Wall time of the run.", num(wall)},
+    {"macros", "Macro calls.", num(stats_.macro)},
+    {"macros_core", "Core macro calls, also counted as internal.", num(stats_.core)},
+    {"macros_internal", "Internal macro calls.", num(stats_.internal)},
+    {"macros_external", "External macro calls.", num(stats_.external)},
+    {"macros_remote", "Remote macro calls.", num(stats_.remote)},
+    {"macros_ignored", "Ignored macros.", num(stats_.ignored)},
+    {"passes", "Passes over macro results.", num(stats_.pass)},
+    {"warnings", "Warnings.", num(stats_.warning)},
+    {"errors", "Errors.", num(stats_.error)},
+    {"regex_compiles", "Regexes compiled.", num(stats_.regex)},
+    {"includes", "Files included.", num(stats_.include)},
+    {"processes", "Child processes started.", num(OB::exec_count())},
+    {"http_requests", "HTTP requests made.", num(Http::requests())},
+    {"cache_hits", "Requests answered from the response cache.", num(cache_->hits.load())},
+    {"cache_revalidations", "Requests answered from the response cache after a revalidation.", num(cache_->revalidations.load())},
+    {"cache_misses", "Requests sent without a usable cache entry.", num(cache_->misses.load())},
+    {"http_connections", "HTTP connections opened, fewer than requests when reused.", num(Http::connections())},
+    {"read_bytes", "Bytes read from input files.", num(stats_.bytes_read)},
+    {"written_bytes", "Bytes written to the output.", num(stats_.bytes_written)},
+    {"peak_rss_bytes", "Peak resident set size.", num(rss)},
+  };
+}
+
+std::string M8::metrics_json(bool failed) const
+{
+  std::ostringstream ss;
+  ss << "{\n";
+  for (auto const& e : metrics(failed))
+  {
+    ss << "  \"" << e.name << "\": " << e.val << ",\n";
+  }
+
+  ss << "  \"remote_latency_seconds\": [";
+  for (std::size_t i = 0; i < stats_.remote_ns.size(); ++i)
+  {
+    ss << (i ? ", " : "") << Json(static_cast<double>(stats_.remote_ns.at(i)) / 1e9).dump();
+  }
+  ss << "]\n}\n";
+
+  return ss.str();
+}
+
+std::string M8::metrics_prom(bool failed) const
+{
+  std::ostringstream ss;
+  for (auto const& e : metrics(failed))
+  {
+    ss
+    << "# HELP m8_" << e.name << " " << e.help << "\n"
+    << "# TYPE m8_" << e.name << " gauge\n"
+    << "m8_" << e.name << " " << e.val << "\n";
+  }
+
+  auto lat = stats_.remote_ns;
+  std::sort(lat.begin(), lat.end());
+  double sum {0};
+  for (auto const& e : lat)
+  {
+    sum += static_cast<double>(e) / 1e9;
+  }
+
+  ss
+  << "# HELP m8_remote_latency_seconds Latency of remote macro requests.\n"
+  << "# TYPE m8_remote_latency_seconds summary\n";
+  for (auto const q : {0.5, 0.9, 0.99})
+  {
+    ss << "m8_remote_latency_seconds{quantile=\"" << q << "\"} ";
+    if (lat.empty())
+    {
+      ss << "NaN\n";
+    }
+    else
+    {
+      auto const i = std::min(lat.size() - 1, static_cast<std::size_t>(q * static_cast<double>(lat.size())));
+      ss << Json(static_cast<double>(lat.at(i)) / 1e9).dump() << "\n";
+    }
+  }
+  ss
+  << "m8_remote_latency_seconds_sum " << Json(sum).dump() << "\n"
+  << "m8_remote_latency_seconds_count " << lat.size() << "\n";
+
+  return ss.str();
+}
+
 std::vector<std::string> M8::suggest_macro(std::string const& name) const
 {
   int const weight_max {8};
@@ -813,6 +1218,7 @@ void M8::set_hook(Htype t, Hook h)
         return;
       }
     }
+    h.rx = compile_regex(h.key);
     hooks.emplace_back(h);
   };
 
@@ -882,13 +1288,21 @@ void M8::rm_hook(Htype t, std::string key)
 
 void M8::run_hooks(Hooks const& h, std::string& s)
 {
+  if (h.empty())
+  {
+    return;
+  }
+
+  Tracer::Span const span {tracer_, "hooks"};
+  Mem_Stats::Scope const mem {"hooks"};
+
   for (auto const& e : h)
   {
     std::string str = s;
     s.clear();
     std::smatch match;
 
-    while (std::regex_search(str, match, std::regex(e.key)))
+    while (std::regex_search(str, match, e.rx))
     {
       std::unordered_map<std::string, std::string> m;
       for (std::size_t i = 1; i < match.size(); ++i)
@@ -914,15 +1328,35 @@ void M8::run_hooks(Hooks const& h, std::string& s)
 
 void M8::parse(std::string const& _ifile, std::string const& _ofile)
 {
+  Tracer::Span const span {tracer_, "parse " + (_ifile.empty() ? std::string("stdin") : _ifile)};
+
   // init the reader
   Reader r;
   if (! settings_.readline || ! _ifile.empty())
   {
     r.open(_ifile);
   }
+  if (! _ifile.empty())
+  {
+    manifest_.file(_ifile);
+  }
 
   // init the writer
   Writer w;
+
+  // the bytes are counted also when the parse fails
+  struct Bytes_Guard
+  {
+    Stats& stats;
+    Reader const& r;
+    Writer const& w;
+    ~Bytes_Guard()
+    {
+      stats.bytes_read += r.bytes();
+      stats.bytes_written += w.bytes();
+    }
+  } const bytes_guard {stats_, r, w};
+
   if (! _ofile.empty())
   {
     w.open(_ofile);
@@ -930,84 +1364,595 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
 
   auto& ast = ast_.ast;
   std::stack<Tmacro> stk;
-  // Cache cache_ {_ifile};
 
-  std::string buf;
-  std::string line;
+  // finds the next possible delimiter in a line
+  Scanner const scan {delim_start_, delim_end_};
 
-  while(r.next(line))
+  // calls of the input split and matched by earlier runs
+  std::optional<Skeleton> skeleton;
+  if (settings_.template_cache && ! _ifile.empty())
   {
-    buf.clear();
+    skeleton.emplace();
+    skeleton->load(_ifile, delim_start_ + '\0' + delim_end_);
+  }
 
-    // check for empty line
-    if (line.empty())
+  // whether a kept call was matched against the current regexes of its macro
+  auto const same_regex = [](Skeleton::Call const& call, Macro const& macro) {
+    if (call.regex.size() != macro.impl.size())
     {
-      // TODO add flag to ignore empty lines
-      if (stk.empty())
+      return false;
+    }
+    for (std::size_t j = 0; j < call.regex.size(); ++j)
+    {
+      if (call.regex[j] != macro.impl[j].regex)
       {
-        // if (! _ofile.empty() && settings_.copy)
-        if (settings_.copy)
-        {
-          w.write("\n");
-        }
-        continue;
+        return false;
       }
-      else
+    }
+    return true;
+  };
+
+  // output of the current line, plain text is referenced from the line
+  Buffer buf;
+
+  // the segment of the current line being parsed,
+  // it points into the reader, edit or results
+  std::string_view line;
+  // storage for a line changed by a hook
+  std::string edit;
+
+  // the rest of the current line as a stack of segments,
+  // a rescanned macro result is pushed in front of it
+  struct Segment
+  {
+    std::string_view str;
+    // offset of the segment in the expanded line
+    std::size_t off;
+  };
+  std::vector<Segment> segs;
+  // storage for rescanned macro results
+  std::deque<std::string> results;
+  // offset of the current segment in the expanded line
+  std::size_t off {0};
+  // the char before the current segment
+  char prev {'\0'};
+  // text follows the deferred result being rescanned,
+  // so the end of the result is not the end of its line
+  bool more {false};
+
+  // char at pos, which may continue into the pending segments
+  auto const peek = [&](std::size_t pos) -> std::optional<char> {
+    if (pos < line.size())
+    {
+      return line[pos];
+    }
+    pos -= line.size();
+    for (auto it = segs.rbegin(); it != segs.rend(); ++it)
+    {
+      if (pos < it->str.size())
       {
-        auto& t = stk.top();
-        t.str += "\n";
-        continue;
+        return it->str[pos];
       }
+      pos -= it->str.size();
     }
+    return {};
+  };
 
-    // commented out line
-    if (! comment_.empty())
+  // whether pos is the last char of the line
+  auto const last = [&](std::size_t pos) {
+    return pos + 1 >= line.size() && ! peek(pos + 1) && ! more;
+  };
+
+  // make the size chars at pos contiguous, so that a delimiter split
+  // between a rescanned result and the rest of the line is found
+  auto const join = [&](std::size_t& pos, std::size_t size) {
+    if (pos + size <= line.size() || segs.empty())
     {
-      auto pos = line.find_first_not_of(" \t");
-      if (pos != std::string::npos)
+      return;
+    }
+    auto& str = results.emplace_back(line.substr(pos));
+    while (str.size() < size && ! segs.empty())
+    {
+      auto& e = segs.back();
+      auto const n = std::min(size - str.size(), e.str.size());
+      str.append(e.str.substr(0, n));
+      e.str.remove_prefix(n);
+      e.off += n;
+      if (e.str.empty())
       {
-        if (line.compare(pos, comment_.size(), comment_) == 0)
-        {
-          continue;
-        }
+        segs.pop_back();
       }
     }
+    if (pos > 0)
+    {
+      prev = line.at(pos - 1);
+    }
+    off += pos;
+    line = str;
+    pos = 0;
+  };
 
-    // whitespace indentation
-    std::size_t indent {0};
-    char indent_char {' '};
+  // the plain text in [begin, end) of the line
+  // the end of the line adds a newline, unless escaped with a backslash
+  auto const text = [&](std::size_t begin, std::size_t end) {
+    std::string_view str {line};
+    str = str.substr(begin, end - begin);
+    bool nl {false};
+    if (end == line.size() && segs.empty() && ! more)
     {
-      std::string e {line.at(0)};
-      if (e.find_first_of(" \t") != std::string::npos)
+      if (line.back() == '\\')
       {
-        std::size_t count {0};
-        for (std::size_t i = 0; i < line.size(); ++i)
-        {
-          e = line.at(i);
-          if (e.find_first_not_of(" \t") != std::string::npos)
+        str.remove_suffix(1);
+      }
+      else
+      {
+        nl = true;
+      }
+    }
+    return std::make_pair(str, nl);
+  };
+
+  auto const read = [&]() {
+    Tracer::Span const read_span {tracer_, "read"};
+    Mem_Stats::Scope const mem {"read"};
+    return r.next(line);
+  };
+
+  // indent every line of a multiline result to the line of its call
+  auto const indent_result = [&](std::string& str, std::size_t indent, char indent_char) {
+    if (indent > 0 && str.find('\n') != std::string::npos)
+    {
+      Mem_Stats::Scope const mem {"replace_all"};
+      std::string indent_str (indent, indent_char);
+      str = OB::String::replace_all(str, "\n", "\n" + indent_str);
+      str = OB::String::replace_last(str, "\n" + indent_str, "\n");
+      str = OB::String::replace_all(str, "\n" + indent_str + "\n", "\n\n");
+    }
+  };
+
+  // top level calls to external and remote macros, and to batched
+  // internal macros, can run alongside the parse,
+  // a result with macros in it is rescanned once the call is resolved
+  bool const deferrable {h_end_.empty() && ! settings_.debug && ! settings_.readline};
+  // with async set, any such call runs on its own thread
+  bool const async {settings_.async > 0 && deferrable};
+  // a deferred result is being rescanned, the calls in it run in order
+  bool rescan {false};
+
+  // a line that waits on async calls, its buffer owns its text
+  struct Async_Line
+  {
+    Buffer buf;
+    // calls not yet resolved
+    std::size_t pending {0};
+    // written even when it is only a newline
+    bool keep {false};
+  };
+  // lines waiting to be written, in order
+  std::deque<Async_Line> lines;
+  // calls not yet resolved on the current line
+  std::size_t pending {0};
+
+  // a call running on its own thread, its result fills a reserved span
+  struct Async_Call
+  {
+    Async_Call(Tmacro&& t_, Macro const& macro_):
+      t {std::move(t_)},
+      name {macro_.name},
+      url {macro_.url},
+      remote {macro_.type == Mtype::remote},
+      batch {(macro_.type == Mtype::remote && macro_.batch) || macro_.type == Mtype::internal},
+      mode {macro_.mode},
+      run {macro_.run}
+    {
+    }
+    Tmacro t;
+    std::string name;
+    std::string url;
+    bool remote;
+    // sent with the other calls to its url
+    bool batch;
+    Xmode mode;
+    // runs the batch of an internal call, and the group it joined
+    batch_fn run;
+    std::string group;
+    Ctx ctx {t.res, t.match, "", nullptr};
+    std::size_t indent {0};
+    char indent_char {' '};
+    // the end delimiter was the last char of its line
+    bool last {false};
+    std::size_t slot {0};
+    // null while the call is on the current line
+    Async_Line* line {nullptr};
+    std::int64_t ns {0};
+    // shared by the calls of a batch, invalid until it is sent
+    std::shared_future<int> fut;
+    // the status of the call within its batch
+    int ec {0};
+  };
+  // calls in the order they were made
+  std::deque<Async_Call> calls;
+  // calls not on a batch, that count against the async limit
+  std::size_t running {0};
+
+  // waits for the threads still using the calls, before they are destroyed
+  struct Async_Guard
+  {
+    std::deque<Async_Call>& calls;
+    ~Async_Guard()
+    {
+      for (auto const& e : calls)
+      {
+        if (e.fut.valid())
+        {
+          e.fut.wait();
+        }
+      }
+    }
+  } const async_guard {calls};
+
+  // batch calls not yet sent, by url,
+  // or by name and group for internal calls
+  std::map<std::string, std::vector<Async_Call*>> batches;
+  // batch calls per request at most
+  std::size_t const max_batch {256};
+
+  // sends the batch calls of a url as one request,
+  // or runs the internal calls of a group together
+  auto const send = [&](std::string const url) {
+    auto const it = batches.find(url);
+    if (it == batches.end())
+    {
+      return;
+    }
+    auto group = std::move(it->second);
+    batches.erase(it);
+
+    std::shared_future<int> fut {std::async(std::launch::async, [this, group, url]() {
+      int ec {0};
+      auto const start = std::chrono::steady_clock::now();
+      try
+      {
+        if (group.front()->remote)
+        {
+          std::vector<Remote_Call> rc;
+          for (auto const& e : group)
           {
-            break;
+            rc.emplace_back(Remote_Call {e->name, e->ctx});
           }
-          ++count;
+          ec = exec_remote_batch(url, rc);
         }
-        indent = count;
-        indent_char = line.at(0);
+        else
+        {
+          std::vector<Ctx*> ctx;
+          for (auto const& e : group)
+          {
+            ctx.emplace_back(&e->ctx);
+          }
+          auto const status = group.front()->run(group.front()->group, ctx);
+          for (std::size_t i = 0; i < group.size(); ++i)
+          {
+            group[i]->ec = status.at(i);
+          }
+        }
+      }
+      catch (std::exception const& e)
+      {
+        for (auto const& c : group)
+        {
+          c->ctx.err_msg = e.what();
+        }
+        ec = -1;
+      }
+      auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+      for (auto const& e : group)
+      {
+        e->ns = ns;
       }
+      return ec;
+    }).share()};
+
+    for (auto const& e : group)
+    {
+      e->fut = fut;
     }
+  };
 
-    // find and replace macro words
-    run_hooks(h_begin_, line);
+  // writes the front lines that are complete
+  auto const flush = [&]() {
+    while (! lines.empty() && lines.front().pending == 0)
+    {
+      auto& l = lines.front();
+      if (l.keep || ! (l.buf.empty() || (l.buf.size() == 1 && l.buf.back() == '\n')))
+      {
+        Tracer::Span const write {tracer_, "write"};
+        Mem_Stats::Scope const mem {"write"};
+        w.write(l.buf);
+      }
+      lines.pop_front();
+    }
+  };
+
+  // parses the current line, set below as it defers calls
+  std::function<void(std::size_t, char)> scan_line;
+
+  // expands the macros in a deferred result, as if the result was
+  // in place of its call, the parse of the current line is put aside
+  auto const expand = [&](Async_Call& c) {
+    Tracer::Span const span {tracer_, "rescan"};
+    auto const line_ = line;
+    auto segs_ = std::move(segs);
+    auto results_ = std::move(results);
+    auto buf_ = std::move(buf);
+    auto stk_ = std::move(stk);
+    auto const off_ = off;
+    auto const prev_ = prev;
+
+    segs.clear();
+    results.clear();
+    buf.clear();
+    stk = std::stack<Tmacro>();
+    line = c.t.res;
+    off = 0;
+    prev = '\0';
+    more = ! c.last;
+    rescan = true;
+
+    scan_line(c.indent, c.indent_char);
+    if (! stk.empty())
+    {
+      auto t = Tmacro();
+      t.name = delim_end_;
+      t.line_start = c.t.line_start;
+      t.line_end = c.t.line_end;
+      t.begin = c.t.begin;
+      std::cerr << error(error_t::missing_closing_delimiter, t, _ifile, c.t.res);
+      throw std::runtime_error("missing closing delimiter");
+    }
+    c.t.res = buf.str();
+
+    rescan = false;
+    more = false;
+    line = line_;
+    segs = std::move(segs_);
+    results = std::move(results_);
+    buf = std::move(buf_);
+    stk = std::move(stk_);
+    off = off_;
+    prev = prev_;
+  };
+
+  // waits on the oldest call and fills its span with the result
+  auto const resolve = [&]() {
+    auto& c = calls.front();
+    if (! c.fut.valid())
+    {
+      send(c.url);
+    }
+    int ec {0};
+    {
+      Tracer::Span const wait_span {tracer_, "async_wait"};
+      ec = c.fut.get();
+    }
+    if (ec == 0)
+    {
+      ec = c.ec;
+    }
+    if (! c.batch)
+    {
+      --running;
+    }
+
+    if (c.remote)
+    {
+      stats_.remote_ns.emplace_back(c.ns);
+      std::cerr << (ec == 0 ? "Success: remote call\n" : "Error: remote call\n");
+    }
+    if (ec != 0)
+    {
+      std::cerr << error(error_t::failed, c.t, _ifile, c.ctx.err_msg);
+      throw std::runtime_error("macro failed");
+    }
 
-    // parse line char by char for either start or end delim
-    for (std::size_t i = 0; i < line.size(); ++i)
+    Mem_Stats::Scope const mem {"result"};
+    run_hooks(h_res_, c.t.res);
+    if (c.t.res.find(delim_start_) != std::string::npos)
+    {
+      expand(c);
+    }
+    else
+    {
+      indent_result(c.t.res, c.indent, c.indent_char);
+      if (! c.t.res.empty() && c.last)
+      {
+        c.t.res += "\n";
+      }
+    }
+
+    if (c.line)
+    {
+      c.line->buf.fill(c.slot, c.t.res);
+      --c.line->pending;
+    }
+    else
+    {
+      buf.fill(c.slot, c.t.res);
+      --pending;
+    }
+    calls.pop_front();
+  };
+
+  // resolves the calls that are already done, without waiting
+  auto const poll = [&]() {
+    while (! calls.empty() && calls.front().fut.valid() &&
+      calls.front().fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+      resolve();
+    }
+    flush();
+  };
+
+  // resolves every call and writes the lines waiting on them
+  auto const drain = [&]() {
+    while (! batches.empty())
+    {
+      send(batches.begin()->first);
+    }
+    // the lines in front of a failed call are still written
+    while (! calls.empty())
+    {
+      resolve();
+      flush();
+    }
+    flush();
+  };
+
+  // starts a call, waiting on the oldest ones while at the limit,
+  // a batch call is only queued until its batch is sent
+  auto const defer = [&](Tmacro&& t, Macro const& macro, std::size_t indent, char indent_char, bool at_end) {
+    bool const batch {(macro.type == Mtype::remote && macro.batch) || macro.type == Mtype::internal};
+    while (! batch && running >= settings_.async)
+    {
+      resolve();
+    }
+    flush();
+
+    if (macro.type == Mtype::remote)
+    {
+      ++stats_.remote;
+      std::cerr << "Remote macro call -> " << macro.name << "\n";
+    }
+    else if (macro.type == Mtype::external)
     {
+      ++stats_.external;
+    }
+
+    auto& c = calls.emplace_back(std::move(t), macro);
+    if (macro.type == Mtype::internal)
+    {
+      // a url has no nul chars, so the keys do not collide
+      c.group = macro.group(c.ctx);
+      c.url = std::string(1, '\0') + c.name + '\0' + c.group;
+    }
+    c.indent = indent;
+    c.indent_char = indent_char;
+    c.last = at_end;
+    c.slot = buf.slot();
+    ++pending;
+
+    if (batch)
+    {
+      auto& group = batches[c.url];
+      group.emplace_back(&c);
+      if (group.size() >= max_batch)
+      {
+        send(c.url);
+      }
+      return;
+    }
+
+    ++running;
+    c.fut = std::async(std::launch::async, [this, &c]() {
+      try
+      {
+        auto const start = std::chrono::steady_clock::now();
+        int ec = c.remote ? exec_remote(c.name, c.url, c.ctx) : exec_external(c.name, c.mode, c.ctx);
+        c.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+        return ec;
+      }
+      catch (std::exception const& e)
+      {
+        c.ctx.err_msg = e.what();
+        return -1;
+      }
+    }).share();
+  };
+
+  // queues the current line behind the lines waiting on async calls
+  auto const hold = [&](bool keep) {
+    buf.own();
+    auto& l = lines.emplace_back();
+    l.buf = std::move(buf);
+    l.pending = pending;
+    l.keep = keep;
+    for (auto it = calls.rbegin(); it != calls.rend() && ! it->line; ++it)
+    {
+      it->line = &l;
+    }
+    buf.clear();
+    pending = 0;
+  };
+
+  // parse line span by span for either start or end delim
+  scan_line = [&](std::size_t const indent, char const indent_char) {
+    for (std::size_t i = 0;; ++i)
+    {
+      // continue with the next segment once the current one is used up
+      while (i >= line.size() && ! segs.empty())
+      {
+        i -= line.size();
+        if (! line.empty())
+        {
+          prev = line.back();
+        }
+        line = segs.back().str;
+        off = segs.back().off;
+        segs.pop_back();
+      }
+
+      if (i >= line.size())
+      {
+        break;
+      }
+
+      // pass the plain text up to the next possible delimiter as a whole
+      {
+        auto const pos = scan.next(line, i);
+
+        if (pos != i)
+        {
+          auto const [str, nl] = text(i, pos);
+
+          if (! stk.empty())
+          {
+            // inside macro
+            auto& t = stk.top();
+            t.str += str;
+            if (nl)
+            {
+              t.str += "\n";
+            }
+          }
+          else if (settings_.copy)
+          {
+            // outside macro
+            buf.view(str);
+            if (nl)
+            {
+              buf.view("\n");
+            }
+          }
+
+          if (pos == line.size())
+          {
+            i = pos - 1;
+            continue;
+          }
+
+          i = pos;
+        }
+      }
+
       // case start delimiter
       if (line.at(i) == delim_start_.at(0))
       {
-        std::size_t pos_start = line.find(delim_start_, i);
-        if (pos_start != std::string::npos && pos_start == i)
+        join(i, delim_start_.size());
+        std::size_t const pos_start {off + i};
+        if (line.compare(i, delim_start_.size(), delim_start_) == 0)
         {
-          if (i > 0 && line.at(i - 1) == '`')
+          if ((i > 0 ? line.at(i - 1) : prev) == '`')
           {
             goto regular_char;
           }
@@ -1032,10 +1977,11 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
       // case end delimiter
       if (line.at(i) == delim_end_.at(0))
       {
-        std::size_t pos_end = line.find(delim_end_, i);
-        if (pos_end != std::string::npos && pos_end == i)
+        join(i, delim_end_.size());
+        std::size_t const pos_end {off + i};
+        if (line.compare(i, delim_end_.size(), delim_end_) == 0)
         {
-          if (i + delim_end_.size() < line.size() && line.at(i + delim_end_.size()) == '`')
+          if (peek(i + delim_end_.size()) == '`')
           {
             goto regular_char;
           }
@@ -1047,7 +1993,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
             t.name = delim_start_;
             t.line_start = r.row();
             t.line_end = r.row();
-            t.begin = i;
+            t.begin = off + i;
             std::cerr << error(error_t::missing_opening_delimiter, t, _ifile, r.line());
             if (settings_.readline)
             {
@@ -1058,21 +2004,32 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
           }
           else
           {
-            auto t = stk.top();
+            auto t = std::move(stk.top());
             stk.pop();
 
+            Tracer::Span macro_span {tracer_, "macro"};
+
             t.line_end = r.row();
             t.end = pos_end;
 
+            // the same call in an earlier run, hooks can change its name and args
+            Skeleton::Call* skel {nullptr};
+            if (skeleton && h_macro_.empty())
+            {
+              skel = skeleton->find(t.str);
+            }
+
             // parse str into name and args
             {
-              std::smatch match;
-              std::string name_args {"^\\s*([^\\s]+)\\s*([^\\r]*?)\\s*$"};
-              // std::string name_args {"^\\s*([^\\s]+)\\s*(?:M8!|)([^\\r]*?)(?:!8M|$)$"};
-              if (std::regex_match(t.str, match, std::regex(name_args)))
+              if (skel)
               {
-                t.name = match[1];
-                t.args = match[2];
+                t.name = skel->name;
+                t.args = skel->args;
+                macro_span.name("macro ", t.name);
+              }
+              else if (split_macro(t.str, t.name, t.args))
+              {
+                macro_span.name("macro ", t.name);
 
                 // find and replace macro words
                 run_hooks(h_macro_, t.name);
@@ -1092,6 +2049,12 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
 
             // validate name and args
             {
+              std::optional<Tracer::Span> validate;
+              validate.emplace(tracer_, "validate");
+              // splitting the args into t.match
+              std::optional<Mem_Stats::Scope> mem_match;
+              mem_match.emplace("match");
+
               auto const it = macros_.find(t.name);
               if (it == macros_.end())
               {
@@ -1108,17 +2071,17 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
 
               if (it->second.impl.at(0).regex.empty())
               {
-                std::vector<std::string> reg_num {
-                  {"^[\\-+]{0,1}[0-9]+$"},
-                  {"^[\\-+]{0,1}[0-9]*\\.[0-9]+$"},
-                  {"^[\\-+]{0,1}[0-9]+e[\\-+]{0,1}[0-9]+$"},
+                static std::vector<std::regex> const reg_num {
+                  std::regex("^[\\-+]{0,1}[0-9]+$"),
+                  std::regex("^[\\-+]{0,1}[0-9]*\\.[0-9]+$"),
+                  std::regex("^[\\-+]{0,1}[0-9]+e[\\-+]{0,1}[0-9]+$"),
                   // {"^[\\-|+]{0,1}[0-9]+/[\\-|+]{0,1}[0-9]+$"},
                 };
 
-                std::vector<std::string> reg_str {
-                  {"^([^`\\\\]*(?:\\\\.[^`\\\\]*)*)$"},
-                  {"^([^'\\\\]*(?:\\\\.[^'\\\\]*)*)$"},
-                  {"^([^\"\\\\]*(?:\\\\.[^\"\\\\]*)*)$"},
+                static std::vector<std::regex> const reg_str {
+                  std::regex("^([^`\\\\]*(?:\\\\.[^`\\\\]*)*)$"),
+                  std::regex("^([^'\\\\]*(?:\\\\.[^'\\\\]*)*)$"),
+                  std::regex("^([^\"\\\\]*(?:\\\\.[^\"\\\\]*)*)$"),
                 };
 
                 // complete arg string as first parameter
@@ -1146,7 +2109,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
                   //   for (auto const& e : reg_num)
                   //   {
                   //     std::smatch m;
-                  //     if (std::regex_match(t.match.back(), m, std::regex(e)))
+                  //     if (std::regex_match(t.match.back(), m, e))
                   //     {
                   //       // std::cerr << "ArgValid\nmacro\n" << t.match.back() << "\n\n";
                   //     }
@@ -1166,7 +2129,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
                     for (auto const& e : reg_num)
                     {
                       std::smatch m;
-                      if (std::regex_match(t.match.back(), m, std::regex(e)))
+                      if (std::regex_match(t.match.back(), m, e))
                       {
                         invalid = false;
                         // std::cerr << "ArgValid\nnum\n" << t.match.back() << "\n\n";
@@ -1219,7 +2182,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
                     for (auto const& e : reg_str)
                     {
                       std::smatch m;
-                      if (std::regex_match(t.match.back(), m, std::regex(e)))
+                      if (std::regex_match(t.match.back(), m, e))
                       {
                         invalid = false;
                         // std::cerr << "ArgValid\nstr\n" << t.match.back() << "\n\n";
@@ -1264,7 +2227,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
                     for (auto const& e : reg_str)
                     {
                       std::smatch m;
-                      if (std::regex_match(mstr, m, std::regex(e)))
+                      if (std::regex_match(mstr, m, e))
                       {
                         invalid = false;
                         // std::cerr << "ArgValid\nstr\n" << t.match.back() << "\n\n";
@@ -1308,7 +2271,7 @@ void M8::parse(std::string const& _ifile, std::string const& _ofile)
                     for (auto const& e : reg_str)
                     {
                       std::smatch m;
-                      if (std::regex_match(t.match.back(), m, std::regex(e)))
+                      if (std::regex_match(t.match.back(), m, e))
                       {
                         invalid = false;
                         // std::cerr << "ArgValid\nstr\n" << t.match.back() << "\n\n";
@@ -1342,16 +2305,18 @@ invalid_arg:
               else
               {
                 bool invalid_regex {true};
-                if (it->second.impl.size() == 1)
+                bool const kept {skel && same_regex(*skel, it->second)};
+                if (kept)
                 {
-                  std::smatch match;
-                  if (std::regex_match(t.args, match, std::regex(it->second.impl.at(0).regex)))
+                  invalid_regex = false;
+                  t.fn_index = skel->fn;
+                  t.match = skel->match;
+                }
+                else if (it->second.impl.size() == 1)
+                {
+                  if (match_macro(it->second.impl.at(0), t.args, t.match))
                   {
                     invalid_regex = false;
-                    for (auto const& e : match)
-                    {
-                      t.match.emplace_back(std::string(e));
-                    }
                   }
                 }
                 else
@@ -1359,21 +2324,20 @@ invalid_arg:
                   std::size_t index {0};
                   for (auto const& rf : it->second.impl)
                   {
-                    std::smatch match;
-                    if (std::regex_match(t.args, match, std::regex(rf.regex)))
+                    if (match_macro(rf, t.args, t.match))
                     {
                       invalid_regex = false;
-                      for (auto const& e : match)
+                      if (settings_.debug)
                       {
-                        t.match.emplace_back(std::string(e));
-                        if (settings_.debug)
+                        for (auto const& e : t.match)
                         {
-                          std::cerr << "arg: " << std::string(e) << "\n";
+                          std::cerr << "arg: " << e << "\n";
                         }
                       }
                       t.fn_index = index;
                       break;
                     }
+                    t.match.clear();
                     ++index;
                   }
                 }
@@ -1388,16 +2352,50 @@ invalid_arg:
                   }
                   throw std::runtime_error("invalid argument");
                 }
+
+                if (skeleton && h_macro_.empty() && ! kept)
+                {
+                  Skeleton::Call call;
+                  call.name = t.name;
+                  call.args = t.args;
+                  for (auto const& e : it->second.impl)
+                  {
+                    call.regex.emplace_back(e.regex);
+                  }
+                  call.fn = t.fn_index;
+                  call.match = t.match;
+                  skeleton->add(t.str, std::move(call));
+                }
+              }
+
+              validate.reset();
+              mem_match.reset();
+
+              // core macros may write to the output,
+              // so the lines in front of them are written first,
+              // which a deferred result can not wait for
+              if (it->second.type == Mtype::core)
+              {
+                if (rescan)
+                {
+                  std::cerr << error(error_t::failed, t, _ifile, "core macros can not run in the result of a deferred call");
+                  throw std::runtime_error("macro failed");
+                }
+                drain();
               }
 
               // process macro
               int ec {0};
+              bool deferred {false};
               Ctx ctx {t.res, t.match, "", nullptr};
               try
               {
+                Profiler::Scope const prof {settings_.profile ? &profiler_ : nullptr, t};
+                Mem_Stats::Scope const mem {"macro ", t.name};
+
                 // ignore matching names
                 std::smatch match;
-                if (std::regex_match(t.name, match, std::regex(ignore_)))
+                if (! ignore_.empty() && std::regex_match(t.name, match, rx_ignore_))
                 {
                   ++stats_.ignored;
                 }
@@ -1406,6 +2404,7 @@ invalid_arg:
                 else if (it->second.type == Mtype::core)
                 {
                   ++stats_.macro;
+                  ++stats_.core;
                   ctx.core = std::make_unique<Core_Ctx>(buf, r, w, _ifile, _ofile);
                   ec = run_internal(it->second.impl.at(t.fn_index).func, ctx);
                 }
@@ -1414,21 +2413,46 @@ invalid_arg:
                 else if (it->second.type == Mtype::internal)
                 {
                   ++stats_.macro;
-                  ec = run_internal(it->second.impl.at(t.fn_index).func, ctx);
+                  if (settings_.batch_compile && deferrable && it->second.run && stk.empty() && ! rescan)
+                  {
+                    // a batched macro runs a program
+                    manifest_.unstable(t.name);
+                    deferred = true;
+                  }
+                  else
+                  {
+                    ec = run_internal(it->second.impl.at(t.fn_index).func, ctx);
+                  }
                 }
 
                 // call remote
                 else if (it->second.type == Mtype::remote)
                 {
                   ++stats_.macro;
-                  ec = run_remote(it->second, ctx);
+                  manifest_.unstable(t.name);
+                  if ((async || (deferrable && it->second.batch)) && stk.empty() && ! rescan)
+                  {
+                    deferred = true;
+                  }
+                  else
+                  {
+                    ec = run_remote(it->second, ctx);
+                  }
                 }
 
                 // call external
                 else if (it->second.type == Mtype::external)
                 {
                   ++stats_.macro;
-                  ec = run_external(it->second, ctx);
+                  manifest_.unstable(t.name);
+                  if (async && stk.empty() && ! rescan)
+                  {
+                    deferred = true;
+                  }
+                  else
+                  {
+                    ec = run_external(it->second, ctx);
+                  }
                 }
               }
               catch (std::exception const& e)
@@ -1442,6 +2466,12 @@ invalid_arg:
                 }
                 throw std::runtime_error("macro failed");
               }
+              if (deferred)
+              {
+                defer(std::move(t), it->second, indent, indent_char, last(i + delim_end_.size() - 1));
+                i += delim_end_.size() - 1;
+                continue;
+              }
               if (ec != 0)
               {
                 std::cerr << error(error_t::failed, t, _ifile, ctx.err_msg);
@@ -1454,6 +2484,9 @@ invalid_arg:
                 throw std::runtime_error("macro failed");
               }
 
+              // handling of the result string
+              Mem_Stats::Scope const mem_result {"result"};
+
               // find and replace macro words
               run_hooks(h_res_, t.res);
 
@@ -1473,7 +2506,19 @@ invalid_arg:
                 // t.res = OB::String::replace_all(t.res, delim_end_ + "\n", delim_end_);
 
                 // TODO handle the same as if it was read from file
-                line.insert(i + delim_end_.size(), t.res);
+                // rescan the result in front of the rest of the line
+                {
+                  auto const pos = i + delim_end_.size();
+                  if (! t.res.empty())
+                  {
+                    if (pos < line.size())
+                    {
+                      segs.push_back({line.substr(pos), off + pos});
+                    }
+                    segs.push_back({results.emplace_back(std::move(t.res)), off + pos});
+                    line = line.substr(0, pos);
+                  }
+                }
                 i += delim_end_.size() - 1;
                 continue;
               }
@@ -1482,7 +2527,7 @@ invalid_arg:
               {
                 stk.top().str += t.res;
 
-                if ((! t.res.empty()) && (i + delim_end_.size() - 1 == line.size() - 1))
+                if ((! t.res.empty()) && last(i + delim_end_.size() - 1))
                 {
                   // account for when end delim is last char on line
                   // add a newline char to buf
@@ -1493,24 +2538,19 @@ invalid_arg:
               else
               {
                 // add indentation
-                {
-                  std::string indent_str (indent, indent_char);
-                  t.res = OB::String::replace_all(t.res, "\n", "\n" + indent_str);
-                  t.res = OB::String::replace_last(t.res, "\n" + indent_str, "\n");
-                  t.res = OB::String::replace_all(t.res, "\n" + indent_str + "\n", "\n\n");
-                }
+                indent_result(t.res, indent, indent_char);
 
-                buf += t.res;
+                buf.copy(t.res);
                 // std::cerr << "t.name: " << t.name << "\n";
                 // std::cerr << "i: " << i << "\n";
                 // std::cerr << "t.res: " << t.res << "\n";
 
-                if ((! t.res.empty()) && (i + delim_end_.size() - 1 == line.size() - 1))
+                if ((! t.res.empty()) && last(i + delim_end_.size() - 1))
                 {
                   // account for when end delim is last char on line
                   // add a newline char to buf
                   // only if response is not empty
-                  buf += "\n";
+                  buf.view("\n");
                 }
               }
             }
@@ -1519,17 +2559,22 @@ invalid_arg:
             if (settings_.debug)
             {
               std::cerr << "\nRes fmt:\n~" << t.res << "~\n";
-              std::cerr << "\nBuf fmt:\n~" << buf << "~\n";
+              std::cerr << "\nBuf fmt:\n~" << buf.str() << "~\n";
             }
 
-            if (stk.empty())
-            {
-              ast.emplace_back(t);
-            }
-            else
+            // the tree is only kept for the debug output,
+            // otherwise the macro is released once it is emitted
+            if (settings_.debug)
             {
-              auto& l = stk.top();
-              l.children.emplace_back(t);
+              if (stk.empty())
+              {
+                ast.emplace_back(std::move(t));
+              }
+              else
+              {
+                auto& l = stk.top();
+                l.children.emplace_back(std::move(t));
+              }
             }
           }
 
@@ -1540,13 +2585,13 @@ invalid_arg:
 
 regular_char:
 
-      // case else other characters
+      // case delimiter char that does not start a delimiter
       if (! stk.empty())
       {
         // inside macro
         auto& t = stk.top();
 
-        if (i == (line.size() - 1))
+        if (last(i))
         {
           if (line.at(i) != '\\')
           {
@@ -1565,25 +2610,124 @@ regular_char:
         // append to output buffer
         if (settings_.copy)
         {
-          if (i == (line.size() - 1))
+          if (last(i))
           {
             if (line.at(i) != '\\')
             {
-              buf += line.at(i);
-              buf += "\n";
+              buf.view({line.data() + i, 1});
+              buf.view("\n");
             }
           }
           else
           {
-            buf += line.at(i);
+            buf.view({line.data() + i, 1});
+          }
+        }
+      }
+
+    }
+  };
+
+  // lines held at most, before waiting on the calls in front of them
+  std::size_t const max_lines {4096};
+
+  while(read())
+  {
+    // scanning the line, which holds the spans of its macro calls
+    std::optional<Tracer::Span> tokenize;
+    tokenize.emplace(tracer_, "tokenize");
+    Mem_Stats::Scope const mem_tokenize {"tokenize"};
+
+    buf.clear();
+    segs.clear();
+    results.clear();
+    off = 0;
+    prev = '\0';
+
+    // check for empty line
+    if (line.empty())
+    {
+      // TODO add flag to ignore empty lines
+      if (stk.empty())
+      {
+        // if (! _ofile.empty() && settings_.copy)
+        if (settings_.copy)
+        {
+          if (! lines.empty())
+          {
+            buf.view("\n");
+            hold(true);
+          }
+          else
+          {
+            w.write("\n");
+          }
+        }
+        continue;
+      }
+      else
+      {
+        auto& t = stk.top();
+        t.str += "\n";
+        continue;
+      }
+    }
+
+    // commented out line
+    if (! comment_.empty())
+    {
+      auto pos = line.find_first_not_of(" \t");
+      if (pos != std::string::npos)
+      {
+        if (line.compare(pos, comment_.size(), comment_) == 0)
+        {
+          continue;
+        }
+      }
+    }
+
+    // whitespace indentation
+    std::size_t indent {0};
+    char indent_char {' '};
+    {
+      std::string e {line.at(0)};
+      if (e.find_first_of(" \t") != std::string::npos)
+      {
+        std::size_t count {0};
+        for (std::size_t i = 0; i < line.size(); ++i)
+        {
+          e = line.at(i);
+          if (e.find_first_not_of(" \t") != std::string::npos)
+          {
+            break;
           }
+          ++count;
         }
+        indent = count;
+        indent_char = line.at(0);
       }
+    }
 
+    // find and replace macro words
+    if (! h_begin_.empty())
+    {
+      edit = line;
+      run_hooks(h_begin_, edit);
+      line = edit;
     }
 
+    scan_line(indent, indent_char);
+
+    tokenize.reset();
+
     // find and replace macro words
-    run_hooks(h_end_, buf);
+    if (! h_end_.empty())
+    {
+      auto str = buf.str();
+      run_hooks(h_end_, str);
+      buf.clear();
+      buf.copy(str);
+    }
 
     if (settings_.debug)
     {
@@ -1594,15 +2738,32 @@ regular_char:
       ast_.clear();
     }
 
-    if (buf.empty() || buf == "\n")
+    // a line with calls still running, or behind such a line, waits its turn
+    if (pending > 0 || ! lines.empty())
+    {
+      hold(false);
+      poll();
+      while (lines.size() > max_lines && ! calls.empty())
+      {
+        resolve();
+      }
+      flush();
+      continue;
+    }
+
+    if (buf.empty() || (buf.size() == 1 && buf.back() == '\n'))
     {
       continue;
     }
 
     // append buf to output file
+    Tracer::Span const write {tracer_, "write"};
+    Mem_Stats::Scope const mem_write {"write"};
     w.write(buf);
   }
 
+  drain();
+
   if (! stk.empty())
   {
     auto t = Tmacro();
@@ -1618,10 +2779,16 @@ regular_char:
   {
     w.close();
   }
+
+  if (skeleton)
+  {
+    skeleton->save();
+  }
 }
 
 int M8::run_internal(macro_fn const& func, Ctx& ctx)
 {
+  Tracer::Span const span {tracer_, "run_internal"};
   ++stats_.internal;
 
   return func(ctx);
@@ -1629,66 +2796,323 @@ int M8::run_internal(macro_fn const& func, Ctx& ctx)
 
 int M8::run_external(Macro const& macro, Ctx& ctx)
 {
+  Tracer::Span const span {tracer_, "run_external"};
   ++stats_.external;
 
-  std::string m_args;
-  for (std::size_t i = 1; i < ctx.args.size(); ++i)
-  {
-    m_args += ctx.args[i];
-    if (i < ctx.args.size() - 1)
-      m_args += " ";
-  }
-  return OB::exec(ctx.str, macro.name + " " + m_args);
+  return exec_external(macro.name, macro.mode, ctx);
 }
 
 int M8::run_remote(Macro const& macro, Ctx& ctx)
 {
+  Tracer::Span const span {tracer_, "run_remote"};
   ++stats_.remote;
 
+  std::cerr << "Remote macro call -> " << macro.name << "\n";
+  auto const start = std::chrono::steady_clock::now();
+  // a batch macro always speaks the batch protocol, as a batch of one
+  int ec = macro.batch ? exec_remote_batch(macro.url, {Remote_Call {macro.name, ctx}}) :
+    exec_remote(macro.name, macro.url, ctx);
+  stats_.remote_ns.emplace_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count());
+  if (ec == 0)
+  {
+    std::cerr << "Success: remote call\n";
+  }
+  else
+  {
+    std::cerr << "Error: remote call\n";
+  }
+
+  return ec;
+}
+
+int M8::exec_external(std::string const& name, Xmode mode, Ctx& ctx) const
+{
+  if (mode == Xmode::coprocess)
+  {
+    return exec_coprocess(name, ctx);
+  }
+
+  std::string err;
+  int status {0};
+  if (mode == Xmode::shell)
+  {
+    std::string m_args;
+    for (std::size_t i = 1; i < ctx.args.size(); ++i)
+    {
+      m_args += ctx.args[i];
+      if (i < ctx.args.size() - 1)
+        m_args += " ";
+    }
+    status = OB::exec(ctx.str, err, name + " " + m_args);
+  }
+  else
+  {
+    std::vector<std::string> argv {name};
+    argv.insert(argv.end(), ctx.args.begin() + 1, ctx.args.end());
+    status = OB::spawn(argv, ctx.str, err);
+  }
+
+  // a program that could not run always fails
+  if (status < 0 || (status > 0 && settings_.exit_status))
+  {
+    ctx.err_msg = err.empty() ? "exit status " + std::to_string(status) : OB::String::trim(err);
+    return -1;
+  }
+  // a program that succeeds can still warn
+  if (! err.empty())
+  {
+    std::cerr << err;
+  }
+
+  return 0;
+}
+
+int M8::exec_coprocess(std::string const& name, Ctx& ctx) const
+{
+  std::shared_ptr<OB::Coprocess> proc;
+  {
+    std::lock_guard<std::mutex> lock {coprocs_->mtx};
+    auto& e = coprocs_->procs[name];
+    if (! e)
+    {
+      e = std::make_shared<OB::Coprocess>(name);
+    }
+    proc = e;
+  }
+
+  // one json object per line, answered by one json value per line
+  Json data;
+  data["name"] = name;
+  data["args"] = ctx.args;
+
+  Json res;
+  try
+  {
+    res = Json::parse(proc->call(data.dump()));
+  }
+  catch (std::exception const&)
+  {
+    // it may be out of step or gone, a new one is started on the next call
+    std::lock_guard<std::mutex> lock {coprocs_->mtx};
+    auto const it = coprocs_->procs.find(name);
+    if (it != coprocs_->procs.end() && it->second == proc)
+    {
+      coprocs_->procs.erase(it);
+    }
+    throw;
+  }
+
+  if (res.is_string())
+  {
+    ctx.str = res.get<std::string>();
+    return 0;
+  }
+  if (res.is_object() && res.count("error") == 1)
+  {
+    ctx.err_msg = res["error"].get<std::string>();
+    return -1;
+  }
+  throw std::runtime_error("expected a string or an error object from the coprocess");
+}
+
+int M8::exec_remote(std::string const& name, std::string const& url, Ctx& ctx) const
+{
   Http api;
   api.req.method = "POST";
   api.req.headers.emplace_back("content-type: application/json");
-  api.req.url = macro.url;
+  api.req.url = url;
 
   Json data;
-  data["name"] = macro.name;
+  data["name"] = name;
   data["args"] = ctx.args;
   api.req.data = data.dump();
 
-  std::cerr << "Remote macro call -> " << macro.name << "\n";
-  std::future<int> send {std::async(std::launch::async, [&]() {
-    api.run();
-    int status_code = api.res.status;
-    if (status_code != 200)
+  http(name, api);
+  if (api.res.status != 200)
+  {
+    return -1;
+  }
+  ctx.str = api.res.body;
+
+  return 0;
+}
+
+int M8::exec_remote_batch(std::string const& url, std::vector<Remote_Call> const& calls) const
+{
+  // the body of each call, as it would be sent on its own
+  std::vector<std::string> bodies;
+  for (auto const& e : calls)
+  {
+    Json data;
+    data["name"] = e.name;
+    data["args"] = e.ctx.args;
+    bodies.emplace_back(data.dump());
+  }
+
+  // fresh cache entries answer their calls, the rest are sent,
+  // a batch is not revalidated
+  std::vector<std::size_t> sent;
+  // calls that repeat one that is sent, and the index of the one sent
+  std::vector<std::pair<std::size_t, std::size_t>> repeats;
+  std::unordered_map<std::string, std::size_t> unique;
+  for (std::size_t i = 0; i < calls.size(); ++i)
+  {
+    auto const& c = calls.at(i);
+    auto const ttl = cache_ttl(c.name, true);
+    if (ttl)
     {
-      return -1;
+      auto const entry = cache_->get(Cache::key(c.name, "POST", url, bodies.at(i)));
+      if (entry && Cache::fresh(*entry, *ttl))
+      {
+        ++cache_->hits;
+        c.ctx.str = entry->val;
+        continue;
+      }
     }
-    else
+    if (ttl)
+    {
+      auto const it = unique.find(bodies.at(i));
+      if (it != unique.end())
+      {
+        ++cache_->hits;
+        repeats.emplace_back(i, it->second);
+        continue;
+      }
+      unique.emplace(bodies.at(i), i);
+      ++cache_->misses;
+    }
+    sent.emplace_back(i);
+  }
+  if (sent.empty())
+  {
+    return 0;
+  }
+
+  Http api;
+  api.req.method = "POST";
+  api.req.headers.emplace_back("content-type: application/json");
+  api.req.url = url;
+
+  api.req.data = "[";
+  for (auto const& i : sent)
+  {
+    if (api.req.data.size() > 1)
     {
-      ctx.str = api.res.body;
-      return 0;
+      api.req.data += ",";
     }
-  })};
+    api.req.data += bodies.at(i);
+  }
+  api.req.data += "]";
 
-  std::future_status fstatus;
-  do
+  api.run();
+  if (api.res.status != 200)
   {
-    fstatus = send.wait_for(std::chrono::milliseconds(250));
-    std::cerr << "." << std::flush;
+    return -1;
   }
-  while (fstatus != std::future_status::ready);
 
-  int ec = send.get();
-  if (ec == 0)
+  // an array of result strings, in the order of the calls
+  Json res = Json::parse(api.res.body);
+  if (! res.is_array() || res.size() != sent.size())
   {
-    std::cerr << aec::erase_line << aec::cr << "Success: remote call\n";
+    throw std::runtime_error("expected an array of " + std::to_string(sent.size()) + " results");
   }
-  else
+  for (std::size_t i = 0; i < sent.size(); ++i)
+  {
+    if (! res.at(i).is_string())
+    {
+      throw std::runtime_error("result " + std::to_string(i) + " is not a string");
+    }
+    auto const& c = calls.at(sent.at(i));
+    c.ctx.str = res.at(i).get<std::string>();
+
+    if (cache_ttl(c.name, true))
+    {
+      Cache::Entry entry;
+      entry.val = c.ctx.str;
+      cache_->set(Cache::key(c.name, "POST", url, bodies.at(sent.at(i))), std::move(entry));
+    }
+  }
+  for (auto const& [i, j] : repeats)
   {
-    std::cerr << aec::erase_line << aec::cr << "Error: remote call\n";
+    calls.at(i).ctx.str = calls.at(j).ctx.str;
   }
 
-  return ec;
+  return 0;
+}
+
+std::optional<std::int64_t> M8::cache_ttl(std::string const& name, bool post) const
+{
+  if (! settings_.cache)
+  {
+    return {};
+  }
+
+  Cache_Policy policy;
+  auto const it = cache_policy_.find(name);
+  if (it != cache_policy_.end())
+  {
+    policy = it->second;
+  }
+
+  // a post request is sent every time unless its macro or the config asks for it to be cached
+  if (! policy.use.value_or(! post || settings_.cache_post))
+  {
+    return {};
+  }
+  return policy.ttl < 0 ? settings_.cache_ttl : policy.ttl;
+}
+
+void M8::http(std::string const& name, Http& api) const
+{
+  auto const ttl = cache_ttl(name, api.req.method == "POST");
+  if (! ttl)
+  {
+    api.run();
+    return;
+  }
+
+  auto const key = Cache::key(name, api.req.method, api.req.url, api.req.data);
+  auto entry = cache_->get(key);
+
+  if (entry && Cache::fresh(*entry, *ttl))
+  {
+    ++cache_->hits;
+    api.res.status = 200;
+    api.res.body = entry->val;
+    return;
+  }
+
+  if (entry && ! entry->etag.empty())
+  {
+    api.req.headers.emplace_back("if-none-match: " + entry->etag);
+  }
+  if (entry && ! entry->last_modified.empty())
+  {
+    api.req.headers.emplace_back("if-modified-since: " + entry->last_modified);
+  }
+
+  api.run();
+
+  // not modified, the stale entry is still good
+  if (entry && api.res.status == 304)
+  {
+    ++cache_->revalidations;
+    api.res.status = 200;
+    api.res.body = entry->val;
+    cache_->set(key, std::move(*entry));
+    return;
+  }
+
+  ++cache_->misses;
+  if (api.res.status == 200)
+  {
+    Cache::Entry e;
+    e.val = api.res.body;
+    e.etag = api.header("etag");
+    e.last_modified = api.header("last-modified");
+    cache_->set(key, std::move(e));
+  }
 }
 
 std::string M8::env_var(std::string const& str) const
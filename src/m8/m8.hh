@@ -4,10 +4,22 @@
 #include "ob/ordered_map.hh"
 #include "ob/scoped_map.hh"
 
+#include "ob/http.hh"
+#include "ob/sys_command.hh"
+
 #include "m8/ast.hh"
+#include "m8/buffer.hh"
+#include "m8/cache.hh"
+#include "m8/manifest.hh"
+#include "m8/matcher.hh"
+#include "m8/profiler.hh"
+#include "m8/tracer.hh"
 #include "m8/reader.hh"
 #include "m8/writer.hh"
 
+#include <cstdint>
+#include <cstddef>
+
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -21,12 +33,15 @@
 #include <utility>
 #include <deque>
 #include <optional>
+#include <memory>
+#include <mutex>
+#include <chrono>
 
 class M8
 {
   struct Core_Ctx
   {
-    Core_Ctx(std::string& buf_, Reader& r_, Writer& w_, std::string ifile_, std::string ofile_):
+    Core_Ctx(Buffer& buf_, Reader& r_, Writer& w_, std::string ifile_, std::string ofile_):
       buf {buf_},
       r {r_},
       w {w_},
@@ -34,7 +49,7 @@ class M8
       ofile {ofile_}
     {
     }
-    std::string& buf;
+    Buffer& buf;
     Reader& r;
     Writer& w;
     std::string ifile;
@@ -49,13 +64,25 @@ class M8
     Args const& args;
     std::string err_msg;
     std::unique_ptr<Core_Ctx> core;
-    // Cache& cache;
   }; // struct Ctx
 
+  // one call of a batched remote request
+  struct Remote_Call
+  {
+    std::string const& name;
+    Ctx& ctx;
+  }; // struct Remote_Call
+
 public:
 
   using macro_fn = std::function<int(Ctx& ctx)>;
 
+  // the batch a call joins, read when the call is made
+  using group_fn = std::function<std::string(Ctx& ctx)>;
+
+  // runs the calls of a batch together, returns the status of each
+  using batch_fn = std::function<std::vector<int>(std::string const& group, std::vector<Ctx*> const& calls)>;
+
   struct macro_t
   {
     macro_t(std::string const& usage_, std::string const& regex_, macro_fn const& func_) :
@@ -67,9 +94,22 @@ public:
 
     std::string usage;
     std::string regex;
+    std::regex rx;
+    Matcher matcher;
     macro_fn func;
   };
 
+  // how the program of an external macro is run
+  enum class Xmode
+  {
+    // once per call, with each argument as its own argv entry
+    exec,
+    // once per call, as a shell command line of the name and arguments
+    shell,
+    // started once, and called over its stdin
+    coprocess
+  };
+
 private:
 
   enum class Mtype
@@ -89,6 +129,12 @@ private:
     // std::vector<std::pair<std::string, macro_fn>> rx_fn;
     std::vector<macro_t> impl;
     std::string url;
+    // remote calls to the url are sent together
+    bool batch {false};
+    Xmode mode {Xmode::exec};
+    // internal calls that run together, when batch compile is on
+    group_fn group {nullptr};
+    batch_fn run {nullptr};
   }; // struct Macro
   OB::Scoped_Map<std::string, Macro> macros_;
 
@@ -99,11 +145,11 @@ public:
 
   // set external macro
   void set_macro(std::string const& name, std::string const& info,
-    std::string const& usage, std::string regex);
+    std::string const& usage, std::string regex, Xmode mode = Xmode::exec);
 
   // set remote macro
   void set_macro(std::string const& name, std::string const& info,
-    std::string const& usage, std::string regex, std::string const& url);
+    std::string const& usage, std::string regex, std::string const& url, bool batch = false);
 
   // set internal macro
   void set_macro(std::string const& name, std::string const& info,
@@ -118,6 +164,9 @@ public:
   // unset internal macro
   void unset_macro(std::string const& name, std::string regex);
 
+  // set how the calls of an internal macro are batched
+  void set_batch(std::string const& name, group_fn group, batch_fn run);
+
   // set core macro
   void set_core(std::string const& name, std::string const& info,
     std::string const& usage, std::string regex, macro_fn func);
@@ -135,6 +184,7 @@ public:
   {
     std::string key;
     std::string val;
+    std::regex rx {};
   };
   using Hooks = std::deque<Hook>;
 
@@ -149,8 +199,48 @@ public:
   void set_config(std::string file_name);
   void set_delimits(std::string const& delim_start, std::string const& delim_end);
   void set_readline(bool val);
+  void set_profile(bool val);
+  void set_trace(std::string const& file_name);
+  void set_trace_folded(std::string const& file_name);
+  // counts allocations from then on, for every M8 object,
+  // called before the first one is made so its macros are counted too
+  static void set_mem_stats(bool val);
+  void set_async(std::size_t val);
+  void set_cache(bool val);
+  void set_template_cache(bool val);
+  void set_batch_compile(bool val);
+  void set_exit_status(bool val);
+
+  // whether a program that exits with a nonzero status fails its macro
+  bool exit_status() const;
+
+  // use the response cache and coprocesses of another run,
+  // such as the one of a parallel job
+  void share(M8 const& other);
+
+  // keep the macros, hooks and manifest as they are after the setup
+  void keep();
+
+  // return to the state kept, dropping what the last input left behind,
+  // the macros it defined, its hooks, included files, stats and manifest
+  void reset();
+
+  // run a request made by macro name, answering it from the response cache
+  // while the entry is fresh, and revalidating a stale entry when it can
+  void http(std::string const& name, Http& api) const;
+
+  // the files, environment variables and values the output depends on
+  Manifest& manifest();
+
+  // adds the stats of another run, such as a parallel job
+  void add_stats(M8 const& other);
 
   std::string summary() const;
+  std::string profile() const;
+  std::string mem_stats() const;
+  // the metrics of the run, failed when it ended with an error
+  std::string metrics_json(bool failed) const;
+  std::string metrics_prom(bool failed) const;
   std::string list_macros() const;
   std::string macro_info(std::string const& name) const;
 
@@ -178,6 +268,21 @@ private:
     bool copy {false};
     bool summary {false};
     bool ignore {false};
+    bool profile {false};
+    // external and remote calls run at once, 0 runs them in order
+    std::size_t async {0};
+    bool cache {true};
+    // seconds an entry from an earlier run is used without revalidating it
+    std::int64_t cache_ttl {0};
+    // post requests can have side effects, they are not cached unless asked for
+    bool cache_post {false};
+    // top level calls of batched internal macros run together
+    bool batch_compile {false};
+    // a program that exits with a nonzero status fails its macro,
+    // otherwise its output is used as it is
+    bool exit_status {false};
+    // calls split and matched by an earlier run of an input are reused
+    bool template_cache {false};
   }; // struct Settings
   Settings settings_;
 
@@ -195,16 +300,71 @@ private:
     int internal {0};
     int external {0};
     int remote {0};
+
+    // regex stats
+    int regex {0};
+
+    // io stats
+    int include {0};
+    std::uint64_t bytes_read {0};
+    std::uint64_t bytes_written {0};
+
+    // remote call latencies in nanoseconds
+    std::vector<std::int64_t> remote_ns;
   }; // struct Stats
   Stats stats_;
 
+  // one value of the metrics export
+  struct Metric
+  {
+    std::string name;
+    std::string help;
+    // formatted as a json number
+    std::string val;
+  }; // struct Metric
+  std::vector<Metric> metrics(bool failed) const;
+
+  // start of the run, for the wall time metric
+  std::chrono::steady_clock::time_point const start_ {std::chrono::steady_clock::now()};
+
   std::string delim_start_ {"[M8["};
   std::string delim_end_ {"]8M]"};
   std::string ignore_;
   std::string comment_;
 
+  // compiled regexes used on every macro call
+  std::regex rx_ignore_;
+
   std::unordered_set<std::string> includes_;
 
+  // what the run read, for --incremental
+  Manifest manifest_;
+
+  // response cache, shared by parallel jobs
+  std::shared_ptr<Cache> cache_ {std::make_shared<Cache>()};
+
+  // coprocesses of external macros by name, started on their first call,
+  // and shared by parallel jobs
+  struct Coprocesses
+  {
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<OB::Coprocess>> procs;
+  }; // struct Coprocesses
+  std::shared_ptr<Coprocesses> coprocs_ {std::make_shared<Coprocesses>()};
+
+  // cache settings of a macro from the config
+  struct Cache_Policy
+  {
+    // unset caches get requests and leaves post requests to the global setting
+    std::optional<bool> use;
+    // seconds, below zero uses the global ttl
+    std::int64_t ttl {-1};
+  }; // struct Cache_Policy
+  std::unordered_map<std::string, Cache_Policy> cache_policy_;
+
+  // ttl of the cache entries of a macro, none when it is not cached
+  std::optional<std::int64_t> cache_ttl(std::string const& name, bool post) const;
+
   std::unordered_map<std::string, std::string> rx_grammar_ {
     {"b", "^"},
     {"e", "$"},
@@ -212,31 +372,64 @@ private:
     {"empty", "^$"},
     {"void", "^$"},
     {"!all", "([^\\r]*?)"},
+    {"!txt", "([^\\r]+?)"},
     {"!wrd", "([^\\s]+?)"},
     {"!num", "([\\-+]{0,1}[0-9]+(?:\\.[0-9]+)?(?:e[\\-+]{0,1}[0-9]+)?)"},
     // {"!int", "([0-9]+)"},
     // {"!dec", "([0-9]+\.[0-9]+)"},
     {"!str_s", "'([^'\\\\]*(?:\\\\.[^'\\\\]*)*)'"},
     {"!str_d", "\"([^\"\\\\]*(?:\\\\.[^\"\\\\]*)*)\""},
+    {"M8!", "(?:M8!|)"},
+    {"!8M", "(?:!8M|$)"},
   };
 
   // abstract syntax tree
   Ast ast_;
 
+  // macro call times
+  Profiler profiler_;
+
+  // timeline of parse phases and macro calls
+  Tracer tracer_;
+
   // hooks
   Hooks h_begin_;
   Hooks h_macro_;
   Hooks h_res_;
   Hooks h_end_;
 
+  // the state after the setup, kept for reset
+  struct Base
+  {
+    OB::Scoped_Map<std::string, Macro> macros;
+    Hooks h_begin;
+    Hooks h_macro;
+    Hooks h_res;
+    Hooks h_end;
+    Manifest manifest;
+  }; // struct Base
+  std::unique_ptr<Base> base_;
+
   void core_macros();
 
+  std::regex compile_regex(std::string const& str);
+  void compile_macro(macro_t& macro);
+  bool match_macro(macro_t const& macro, std::string const& str, Args& res) const;
+  bool split_macro(std::string const& str, std::string& name, std::string& args) const;
+
   void run_hooks(Hooks const& h, std::string& s);
 
   int run_internal(macro_fn const& func, Ctx& ctx);
   int run_external(Macro const& macro, Ctx& ctx);
   int run_remote(Macro const& macro, Ctx& ctx);
 
+  // the calls themselves, they touch no parser state
+  // and can run on any thread
+  int exec_external(std::string const& name, Xmode mode, Ctx& ctx) const;
+  int exec_coprocess(std::string const& name, Ctx& ctx) const;
+  int exec_remote(std::string const& name, std::string const& url, Ctx& ctx) const;
+  int exec_remote_batch(std::string const& url, std::vector<Remote_Call> const& calls) const;
+
   std::string env_var(std::string const& str) const;
   std::vector<std::string> suggest_macro(std::string const& name) const;
 }; // class M8
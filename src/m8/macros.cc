@@ -1,6 +1,7 @@
 #include "m8/macros.hh"
 
 #include "m8/m8.hh"
+#include "m8/mem_stats.hh"
 
 #include "ob/sys_command.hh"
 #include "ob/crypto.hh"
@@ -36,6 +37,8 @@ using Json = nlohmann::json;
 #include <stdexcept>
 #include <utility>
 #include <random>
+#include <atomic>
+#include <mutex>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -44,12 +47,23 @@ namespace Macros
 {
 
 // variables
-std::unordered_map<std::string, std::string> db;
-std::string m8_delim_start;
-std::string m8_delim_end;
+// each worker thread runs its own M8, so these are kept per thread
+thread_local std::unordered_map<std::string, std::string> db;
+thread_local std::string m8_delim_start;
+thread_local std::string m8_delim_end;
 
 // prototypes
 int ftostr(std::string f, std::string& s);
+std::string tmp_path(std::string const& name);
+std::string exit_error(int status, std::string const& err);
+bool failed(int status, bool check);
+std::string compiler_version(std::string const& compiler);
+std::vector<std::string> dep_files(std::string const& str);
+bool same_headers(std::string const& file);
+int compile_snippet(std::string const& compiler, std::string const& ext,
+  std::string const& code, std::string const& flags, std::string& bin, std::string& err);
+std::string snippet_code(std::string const& headers, std::string const& body);
+std::string snippet_group(std::string const& lang);
 
 int ftostr(std::string f, std::string& s)
 {
@@ -64,6 +78,203 @@ int ftostr(std::string f, std::string& s)
   return 0;
 }
 
+// a path in the .m8 dir unique to this call, parallel workers share the dir
+std::string tmp_path(std::string const& name)
+{
+  static std::atomic<std::size_t> id {0};
+  return ".m8/.m8-" + std::to_string(getpid()) + "-" + std::to_string(id++) + "-" + name;
+}
+
+// the reason a program failed, its stderr or else its exit status
+std::string exit_error(int status, std::string const& err)
+{
+  auto str = OB::String::trim(err);
+  if (str.empty())
+  {
+    str = "exit status " + std::to_string(status);
+  }
+  return str;
+}
+
+// the output of the compiler's --version, asked once per process
+std::string compiler_version(std::string const& compiler)
+{
+  static std::mutex mtx;
+  static std::unordered_map<std::string, std::string> versions;
+
+  std::lock_guard<std::mutex> lock {mtx};
+  auto it = versions.find(compiler);
+  if (it == versions.end())
+  {
+    std::string out;
+    std::string err;
+    OB::spawn({compiler, "--version"}, out, err);
+    it = versions.emplace(compiler, out).first;
+  }
+  return it->second;
+}
+
+// the prerequisites of a make rule written by the compiler,
+// the first is the source itself
+std::vector<std::string> dep_files(std::string const& str)
+{
+  std::vector<std::string> files;
+  auto pos = str.find(": ");
+  if (pos == std::string::npos)
+  {
+    return files;
+  }
+  std::string file;
+  for (pos += 2; pos < str.size(); ++pos)
+  {
+    auto const c = str[pos];
+    if (c == '\\' && pos + 1 < str.size() && str[pos + 1] == ' ')
+    {
+      file += ' ';
+      ++pos;
+    }
+    else if (c == '\\' || c == ' ' || c == '\n' || c == '\t')
+    {
+      if (! file.empty())
+      {
+        files.emplace_back(std::move(file));
+        file.clear();
+      }
+    }
+    else
+    {
+      file += c;
+    }
+  }
+  if (! file.empty())
+  {
+    files.emplace_back(std::move(file));
+  }
+  return files;
+}
+
+// whether the headers a binary was compiled with are unchanged,
+// the file lists the hash and path of each header outside the system dirs
+bool same_headers(std::string const& file)
+{
+  std::ifstream ifile {file};
+  if (! ifile.is_open())
+  {
+    return false;
+  }
+  std::string hash;
+  std::string path;
+  while (ifile >> hash && std::getline(ifile >> std::ws, path))
+  {
+    std::string str;
+    if (ftostr(path, str) != 0 || OB::Crypto::sha256(str) != hash)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// compile a snippet into the binary cache under .m8/bin,
+// named by a hash of the compiler, its version, the flags, and the code,
+// a snippet that was compiled before reuses its binary
+// while the headers it included outside the system dirs are unchanged
+int compile_snippet(std::string const& compiler, std::string const& ext,
+  std::string const& code, std::string const& flags, std::string& bin, std::string& err)
+{
+  std::string key {compiler};
+  for (auto const& e : {compiler_version(compiler), flags, code})
+  {
+    key += '\0';
+    key += e;
+  }
+  bin = ".m8/bin/" + OB::Crypto::sha256(key);
+  if (fs::exists(bin) && same_headers(bin + ".deps"))
+  {
+    return 0;
+  }
+
+  std::error_code ec;
+  fs::create_directories(".m8/bin", ec);
+
+  std::string const tmp {tmp_path(ext)};
+  std::string const path {tmp + "." + ext};
+  std::ofstream ofile {path};
+  ofile << code;
+  ofile.close();
+
+  // the flags go through the shell, which expands
+  // their quotes and substitutions such as $(pkg-config --cflags x)
+  std::string out;
+  auto const status = OB::exec(out, err, compiler + " " + path + " -o " + tmp + " -MMD -MF " + tmp + ".d " + flags);
+  fs::remove(fs::path(path), ec);
+  std::string deps;
+  ftostr(tmp + ".d", deps);
+  fs::remove(fs::path(tmp + ".d"), ec);
+  if (status != 0)
+  {
+    fs::remove(fs::path(tmp), ec);
+    return status;
+  }
+
+  // the headers are kept before the binary, so a binary is never found without them
+  {
+    auto const files = dep_files(deps);
+    std::ofstream hfile {tmp + ".deps"};
+    for (std::size_t i = 1; i < files.size(); ++i)
+    {
+      std::string str;
+      ftostr(files[i], str);
+      hfile << OB::Crypto::sha256(str) << " " << files[i] << "\n";
+    }
+  }
+  fs::rename(tmp + ".deps", bin + ".deps", ec);
+
+  // the rename is atomic, other processes see the whole binary or none
+  fs::rename(tmp, bin, ec);
+  if (ec)
+  {
+    fs::remove(fs::path(tmp), ec);
+    err = "could not store '" + bin + "'";
+    return -1;
+  }
+
+  return 0;
+}
+
+// the source of a snippet, which is the body of main
+std::string snippet_code(std::string const& headers, std::string const& body)
+{
+  return headers + "\n\nint main(){\n" + body + "\n}";
+}
+
+// the flags and headers of a language, read when a snippet is called,
+// as the group its batch is compiled with
+std::string snippet_group(std::string const& lang)
+{
+  Json j {{"flags", ""}, {"headers", ""}};
+  for (auto const& e : {"flags", "headers"})
+  {
+    if (auto const it = db.find(lang + "-" + e); it != db.end())
+    {
+      j[e] = it->second;
+    }
+  }
+  return j.dump();
+}
+
+// whether a program failed, one that could not run always has,
+// a nonzero exit status only when it is checked
+bool failed(int status, bool check)
+{
+  return status < 0 || (status > 0 && check);
+}
+
+void reset()
+{
+  db.clear();
+}
+
 void macros(M8& m8)
 {
 
@@ -77,7 +288,9 @@ auto const fn_repeat = [](auto& ctx) {
   return 0;
 };
 
-auto const fn_comment_header = [](auto& ctx) {
+auto const fn_comment_header = [&](auto& ctx) {
+  // the timestamp changes every run
+  m8.manifest().unstable("comment_header");
   std::stringstream ss; ss
   << "// timestamp:   " << std::time(nullptr) << "\n"
   << "// Version:     " << ctx.args.at(1) << "\n"
@@ -128,12 +341,20 @@ auto const fn_license = [](auto& ctx) {
   return 0;
 };
 
-auto const fn_sh = [](auto& ctx) {
-  // TODO return error on failed shell command
-  return OB::exec(ctx.str, ctx.args.at(1));
+auto const fn_sh = [&](auto& ctx) {
+  m8.manifest().unstable("sh");
+  std::string err;
+  auto const status = OB::exec(ctx.str, err, ctx.args.at(1));
+  if (failed(status, m8.exit_status()))
+  {
+    ctx.err_msg = exit_error(status, err);
+    return -1;
+  }
+  std::cerr << err;
+  return 0;
 };
 
-auto const fn_file = [](auto& ctx) {
+auto const fn_file = [&](auto& ctx) {
   auto file_path = ctx.args.at(1);
   if (file_path.empty())
   {
@@ -144,6 +365,7 @@ auto const fn_file = [](auto& ctx) {
   {
     file_path.replace(0, 1, std::getenv("HOME"));
   }
+  m8.manifest().file(file_path);
 
   std::ifstream file {file_path};
   if (! file.is_open())
@@ -161,7 +383,8 @@ auto const fn_file = [](auto& ctx) {
   return 0;
 };
 
-auto const fn_env = [](auto& ctx) {
+auto const fn_env = [&](auto& ctx) {
+  m8.manifest().env(ctx.args.at(1));
   const char *e = std::getenv(ctx.args.at(1).c_str());
   if (e)
   {
@@ -355,7 +578,8 @@ auto const fn_cat = [](auto& ctx) {
   return 0;
 };
 
-auto const fn_term_width = [](auto& ctx) {
+auto const fn_term_width = [&](auto& ctx) {
+  m8.manifest().unstable("term-width");
   struct winsize w;
   ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
   int width = w.ws_col;
@@ -364,6 +588,7 @@ auto const fn_term_width = [](auto& ctx) {
 };
 
 auto const fn_http_get = [&](auto& ctx) {
+  m8.manifest().unstable("http-get");
   if (ctx.args.size() != 2)
   {
     ctx.err_msg = "expected URL parameter";
@@ -374,7 +599,7 @@ auto const fn_http_get = [&](auto& ctx) {
   Http api;
   api.req.method = "GET";
   api.req.url = url;
-  api.run();
+  m8.http("http-get", api);
   ctx.str = api.res.body;
 
   if (api.res.status != 200)
@@ -386,6 +611,7 @@ auto const fn_http_get = [&](auto& ctx) {
 };
 
 auto const fn_http_post = [&](auto& ctx) {
+  m8.manifest().unstable("http-post");
   if (ctx.args.size() != 3)
   {
     ctx.err_msg = "expected URL and data parameters";
@@ -400,7 +626,7 @@ auto const fn_http_post = [&](auto& ctx) {
   api.req.method = "POST";
   api.req.url = url;
   api.req.data = data;
-  api.run();
+  m8.http("http-post", api);
   ctx.str = api.res.body;
 
   if (api.res.status != 200)
@@ -467,8 +693,11 @@ auto const fn_template = [&](auto& ctx) {
   }
 
   tmp = OB::String::unescape(tmp);
-  tmp = OB::String::replace_all(tmp, "[[", "((");
-  tmp = OB::String::replace_all(tmp, "]]", "))");
+  {
+    Mem_Stats::Scope const mem {"replace_all"};
+    tmp = OB::String::replace_all(tmp, "[[", "((");
+    tmp = OB::String::replace_all(tmp, "]]", "))");
+  }
   ctx.str = tmp;
 
   return 0;
@@ -483,6 +712,7 @@ auto const fn_math_abs = [&](auto& ctx) {
 };
 
 auto const fn_date = [&](auto& ctx) {
+  m8.manifest().unstable("date");
   std::stringstream ss;
   std::time_t t {std::time(nullptr)};
   std::tm tm = *std::localtime(&t);
@@ -529,6 +759,7 @@ auto const fn_math_round = [&](auto& ctx) {
 };
 
 auto const fn_in = [&](auto& ctx) {
+  m8.manifest().unstable("in");
   auto str = std::string();
   std::cout << "> ";
   std::getline(std::cin, str);
@@ -755,8 +986,11 @@ auto const fn_def = [&](auto& ctx) {
     // }
     // TODO should unescape be removed?
     // tmp = OB::String::unescape(tmp);
-    tmp = OB::String::replace_all(tmp, "`" + delim_start, delim_start);
-    tmp = OB::String::replace_all(tmp, delim_end + "`", delim_end);
+    {
+      Mem_Stats::Scope const mem {"replace_all"};
+      tmp = OB::String::replace_all(tmp, "`" + delim_start, delim_start);
+      tmp = OB::String::replace_all(tmp, delim_end + "`", delim_end);
+    }
     ctx.str = tmp;
     return 0;
   })});
@@ -792,8 +1026,11 @@ auto const fn_def_s = [&](auto& ctx) {
     // }
     // TODO should unescape be removed?
     // tmp = OB::String::unescape(tmp);
-    tmp = OB::String::replace_all(tmp, "`" + delim_start, delim_start);
-    tmp = OB::String::replace_all(tmp, delim_end + "`", delim_end);
+    {
+      Mem_Stats::Scope const mem {"replace_all"};
+      tmp = OB::String::replace_all(tmp, "`" + delim_start, delim_start);
+      tmp = OB::String::replace_all(tmp, delim_end + "`", delim_end);
+    }
     ctx.str = tmp;
     return 0;
   })});
@@ -818,7 +1055,117 @@ auto const fn_undef_s = [&](auto& ctx) {
   return 0;
 };
 
+// compiles the snippets of a batch into one program, each in its own function,
+// main runs them in order and ends the output of each with a mark,
+// snippets the program did not finish are compiled and run on their own
+auto const run_snippets = [](std::string const& compiler, std::string const& ext,
+  std::string const& group, auto const& calls, bool check) {
+  auto const j = Json::parse(group);
+  auto const flags = j["flags"].get<std::string>();
+  auto const headers = j["headers"].get<std::string>();
+
+  std::string body;
+  for (auto const& e : calls)
+  {
+    body += e->args.at(1);
+    body += '\0';
+  }
+  // a mark that the snippets can not know, and that is the same each run
+  // so the program is found in the compile cache
+  std::string const mark {"\x1e" + OB::Crypto::sha256(headers + '\0' + body) + "-"};
+
+  std::stringstream code; code
+  << "#include <stdio.h>\n"
+  << headers
+  << "\n\n";
+  for (std::size_t i = 0; i < calls.size(); ++i)
+  {
+    code
+    << "static int m8_snippet_" << i << "(void)\n{\n"
+    << calls[i]->args.at(1)
+    << "\nreturn 0;\n}\n\n";
+  }
+  code << "int main(){\n";
+  for (std::size_t i = 0; i < calls.size(); ++i)
+  {
+    code
+    << "printf(\"" << mark << i << " %d\\n\", m8_snippet_" << i << "());\n"
+    << "fflush(stdout);\n";
+  }
+  code << "return 0;\n}";
+
+  std::vector<int> status (calls.size(), 0);
+  std::size_t done {0};
+
+  std::string bin;
+  std::string out;
+  std::string err;
+  if (compile_snippet(compiler, ext, code.str(), flags, bin, err) != 0)
+  {
+    // the snippets may still compile on their own,
+    // so the reason the program failed is shown here
+    std::cerr << "batch compile failed, compiling each snippet on its own:\n"
+      << OB::String::trim(err) << "\n";
+  }
+  else
+  {
+    err.clear();
+    OB::spawn({bin}, out, err);
+
+    // split the output on the marks, each followed by its index and status
+    std::size_t pos {0};
+    for (; done < calls.size(); ++done)
+    {
+      auto const id = mark + std::to_string(done) + " ";
+      auto const end = out.find(id, pos);
+      if (end == std::string::npos)
+      {
+        break;
+      }
+      calls[done]->str = out.substr(pos, end - pos);
+      auto const nl = out.find('\n', end);
+      if (nl == std::string::npos)
+      {
+        break;
+      }
+      status[done] = std::stoi(out.substr(end + id.size(), nl - end - id.size()));
+      if (! failed(status[done], check))
+      {
+        status[done] = 0;
+      }
+      if (status[done] != 0)
+      {
+        calls[done]->err_msg = exit_error(status[done], err);
+      }
+      pos = nl + 1;
+    }
+  }
+
+  for (; done < calls.size(); ++done)
+  {
+    auto& ctx = *calls[done];
+    err.clear();
+    status[done] = compile_snippet(compiler, ext, snippet_code(headers, ctx.args.at(1)), flags, bin, err);
+    if (status[done] == 0)
+    {
+      err.clear();
+      status[done] = OB::spawn({bin}, ctx.str, err);
+      if (! failed(status[done], check))
+      {
+        status[done] = 0;
+      }
+    }
+    if (status[done] != 0)
+    {
+      ctx.err_msg = exit_error(status[done], err);
+    }
+  }
+
+  return status;
+};
+
 auto const fn_c = [&](auto& ctx) {
+  m8.manifest().unstable("c");
   std::string flags;
   if (db.find("c-flags") != db.end())
   {
@@ -830,36 +1177,30 @@ auto const fn_c = [&](auto& ctx) {
     headers = db["c-headers"];
   }
 
-  std::stringstream code; code
-  << headers
-  << "\n\nint main(){\n"
-  << ctx.args.at(1)
-  << "\n}";
-
-  std::string const path {".m8/.m8-c.c"};
-  std::ofstream ofile {path};
-  ofile << code.str();
-  ofile.close();
-
-  std::string out;
-  std::string const compile {"gcc .m8/.m8-c.c -o .m8/.m8-c " + flags};
-  if (OB::exec(out, compile) != 0)
+  std::string bin;
+  std::string err;
+  int status {compile_snippet("gcc", "c", snippet_code(headers, ctx.args.at(1)), flags, bin, err)};
+  if (status == 0)
   {
-    return -1;
+    err.clear();
+    status = OB::spawn({bin}, ctx.str, err);
+    if (! failed(status, m8.exit_status()))
+    {
+      status = 0;
+    }
   }
 
-  if (OB::exec(ctx.str, ".m8/.m8-c") != 0)
+  if (status != 0)
   {
+    ctx.err_msg = exit_error(status, err);
     return -1;
   }
 
-  fs::remove(fs::path(".m8/.m8-c"));
-  fs::remove(fs::path(".m8/.m8-c.c"));
-
   return 0;
 };
 
 auto const fn_cpp = [&](auto& ctx) {
+  m8.manifest().unstable("cpp");
   std::string flags;
   if (db.find("cpp-flags") != db.end())
   {
@@ -871,46 +1212,48 @@ auto const fn_cpp = [&](auto& ctx) {
     headers = db["cpp-headers"];
   }
 
-  std::stringstream code; code
-  << headers
-  << "\n\nint main(){\n"
-  << ctx.args.at(1)
-  << "\n}";
-
-  std::string const path {".m8/.m8-cpp.cc"};
-  std::ofstream ofile {path};
-  ofile << code.str();
-  ofile.close();
-
-  std::string out;
-  std::string const compile {"g++ .m8/.m8-cpp.cc -o .m8/.m8-cpp " + flags};
-  if (OB::exec(out, compile) != 0)
+  std::string bin;
+  std::string err;
+  int status {compile_snippet("g++", "cc", snippet_code(headers, ctx.args.at(1)), flags, bin, err)};
+  if (status == 0)
   {
-    return -1;
+    err.clear();
+    status = OB::spawn({bin}, ctx.str, err);
+    if (! failed(status, m8.exit_status()))
+    {
+      status = 0;
+    }
   }
 
-  if (OB::exec(ctx.str, ".m8/.m8-cpp") != 0)
+  if (status != 0)
   {
+    ctx.err_msg = exit_error(status, err);
     return -1;
   }
 
-  fs::remove(fs::path(".m8/.m8-cpp"));
-  fs::remove(fs::path(".m8/.m8-cpp.cc"));
-
   return 0;
 };
 
 auto const fn_script = [&](auto& ctx) {
+  m8.manifest().unstable("script");
   auto str = ctx.args.at(1);
-  std::string const path {".m8/.m8-script.tmp.m8"};
+  std::string const path {tmp_path("script.tmp.m8")};
   std::ofstream ofile {path};
   ofile << str;
   ofile.close();
   fs::permissions(path, fs::perms::owner_exec, fs::perm_options::add);
-  auto const status = OB::exec(ctx.str, path);
+  std::string err;
+  auto const status = OB::spawn({path}, ctx.str, err);
   fs::remove(fs::path(path));
 
-  return status;
+  if (failed(status, m8.exit_status()))
+  {
+    ctx.err_msg = exit_error(status, err);
+    return -1;
+  }
+  std::cerr << err;
+
+  return 0;
 };
 
 auto const fn_mod = [&](auto& ctx) {
@@ -1058,6 +1401,7 @@ m8.set_macro("rand",
   "",
   "{empty}",
   [&](auto& ctx) {
+  m8.manifest().unstable("rand");
   std::random_device rd;
   std::mt19937 gen(rd());
   ctx.str = std::to_string(gen());
@@ -1069,6 +1413,7 @@ m8.set_macro("nano",
   "",
   "{empty}",
   [&](auto& ctx) {
+  m8.manifest().unstable("nano");
   auto tnano = std::chrono::system_clock::now().time_since_epoch();
   long int uuid = std::chrono::duration_cast<std::chrono::nanoseconds>(tnano).count();
   ctx.str = std::to_string(uuid);
@@ -1151,9 +1496,9 @@ m8.set_macro("printc!",
 m8.set_macro("def",
   "define a macro",
   {
-    M8::macro_t("{name:str_s} {info:str_s} {regex:str_s} {body:all}", "{b}{!str_s}{ws}{!str_s}{ws}{!str_s}{ws}(?:M8!|)([^\\r]+?)(?:!8M|{e})", fn_def),
-    M8::macro_t("{name:wrd} {info:str_s} {regex:str_s} {body:all}", "{b}{!wrd}{ws}{!str_s}{ws}{!str_s}{ws}(?:M8!|)([^\\r]+?)(?:!8M|{e})", fn_def),
-    M8::macro_t("{name:wrd} {body:all}", "{b}{!wrd}{ws}(?:M8!|){!all}(?:!8M|{e})", fn_def_s),
+    M8::macro_t("{name:str_s} {info:str_s} {regex:str_s} {body:all}", "{b}{!str_s}{ws}{!str_s}{ws}{!str_s}{ws}{M8!}{!txt}{!8M}", fn_def),
+    M8::macro_t("{name:wrd} {info:str_s} {regex:str_s} {body:all}", "{b}{!wrd}{ws}{!str_s}{ws}{!str_s}{ws}{M8!}{!txt}{!8M}", fn_def),
+    M8::macro_t("{name:wrd} {body:all}", "{b}{!wrd}{ws}{M8!}{!all}{!8M}", fn_def_s),
     // {"{b}{!str_s}{ws}(?:M8!|)([^\\r]+?)(?:!8M|{e})", fn_def_s},
     // {"^(.+?)\\s+(?:M8!|)([^\\r]+?)(?:!8M|$)", fn_def_l},
   });
@@ -1177,6 +1522,14 @@ m8.set_macro("cpp",
   "^([^\\r]+)$",
   fn_cpp);
 
+m8.set_batch("c",
+  [](auto&) { return snippet_group("c"); },
+  [run_snippets, &m8](auto const& group, auto const& calls) { return run_snippets("gcc", "c", group, calls, m8.exit_status()); });
+
+m8.set_batch("cpp",
+  [](auto&) { return snippet_group("cpp"); },
+  [run_snippets, &m8](auto const& group, auto const& calls) { return run_snippets("g++", "cc", group, calls, m8.exit_status()); });
+
 m8.set_macro("script",
   "run a script",
   "script <str>",
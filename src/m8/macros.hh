@@ -8,11 +8,16 @@
 namespace Macros
 {
 
-  extern std::string m8_delim_start;
-  extern std::string m8_delim_end;
+  extern thread_local std::string m8_delim_start;
+  extern thread_local std::string m8_delim_end;
 
+  // registers the built-in macros
   void macros(M8& m8);
 
+  // clears the macro state of the thread, such as the values of set,
+  // the thread may have run another input before
+  void reset();
+
 } // namespace Macros
 
 #endif // M8_MACROS_M8_HH
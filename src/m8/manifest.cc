@@ -0,0 +1,190 @@
+#include "m8/manifest.hh"
+
+#include "ob/crypto.hh"
+#include "ob/string.hh"
+
+#include "lib/json.hh"
+using Json = nlohmann::json;
+
+#include <cstdlib>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <mutex>
+#include <stdexcept>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+Manifest::Manifest()
+{
+}
+
+Manifest::~Manifest()
+{
+}
+
+void Manifest::file(std::string const& path)
+{
+  files_.emplace(path);
+}
+
+void Manifest::binary(std::string const& path)
+{
+  binaries_.emplace(path);
+}
+
+void Manifest::env(std::string const& name)
+{
+  env_.emplace(name);
+}
+
+void Manifest::unstable(std::string const& name)
+{
+  unstable_.emplace(name);
+}
+
+void Manifest::value(std::string const& key, std::string const& val)
+{
+  values_.insert_or_assign(key, val);
+}
+
+std::string Manifest::path(std::string const& ofile)
+{
+  return ".m8/deps/" + OB::String::url_encode(ofile) + ".json";
+}
+
+std::string Manifest::hash(std::string const& path)
+{
+  std::ifstream file {path};
+  if (! file.is_open())
+  {
+    return {};
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+  return OB::Crypto::sha256(ss.str());
+}
+
+std::string Manifest::file_hash(std::string const& path) const
+{
+  if (binaries_.count(path) == 0)
+  {
+    return hash(path);
+  }
+
+  // shared by the parallel jobs
+  static std::mutex mtx;
+  static std::map<std::string, std::string> hashes;
+  std::lock_guard<std::mutex> const lock {mtx};
+  auto it = hashes.find(path);
+  if (it == hashes.end())
+  {
+    it = hashes.emplace(path, hash(path)).first;
+  }
+  return it->second;
+}
+
+void Manifest::save(std::string const& ofile) const
+{
+  Json j {
+    {"output", hash(ofile)},
+    {"values", values_},
+    {"files", Json::object()},
+    {"env", Json::object()},
+    {"unstable", unstable_},
+  };
+
+  for (auto const& e : files_)
+  {
+    j["files"][e] = hash(e);
+  }
+  for (auto const& e : binaries_)
+  {
+    j["files"][e] = file_hash(e);
+  }
+
+  // an unset variable is null, which differs from an empty one
+  for (auto const& e : env_)
+  {
+    auto const val = std::getenv(e.c_str());
+    j["env"][e] = val ? Json(val) : Json(nullptr);
+  }
+
+  auto const file_name = path(ofile);
+  fs::create_directories(fs::path(file_name).parent_path());
+
+  auto const tmp = file_name + ".tmp";
+  {
+    std::ofstream file {tmp};
+    if (! file.is_open())
+    {
+      throw std::runtime_error("could not write the manifest of '" + ofile + "'");
+    }
+    file << j.dump(2);
+  }
+  fs::rename(tmp, file_name);
+}
+
+bool Manifest::fresh(std::string const& ofile) const
+{
+  std::ifstream file {path(ofile)};
+  if (! file.is_open())
+  {
+    return false;
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+
+  // a damaged manifest makes the output stale
+  Json j;
+  try
+  {
+    j = Json::parse(ss.str());
+
+    if (! j.at("unstable").empty())
+    {
+      return false;
+    }
+
+    if (j.at("values").get<std::map<std::string, std::string>>() != values_)
+    {
+      return false;
+    }
+
+    auto const out = hash(ofile);
+    if (out.empty() || out != j.at("output").get<std::string>())
+    {
+      return false;
+    }
+
+    auto const& files = j.at("files");
+    for (auto it = files.begin(); it != files.end(); ++it)
+    {
+      if (file_hash(it.key()) != it.value().get<std::string>())
+      {
+        return false;
+      }
+    }
+
+    auto const& env = j.at("env");
+    for (auto it = env.begin(); it != env.end(); ++it)
+    {
+      auto const now = std::getenv(it.key().c_str());
+      auto const& val = it.value();
+      if (val.is_null() ? now != nullptr : (now == nullptr || val.get<std::string>() != now))
+      {
+        return false;
+      }
+    }
+  }
+  catch (std::exception const&)
+  {
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,59 @@
+#ifndef M8_MANIFEST_HH
+#define M8_MANIFEST_HH
+
+#include <string>
+#include <map>
+#include <set>
+
+// everything a run read to make an output, kept with the output,
+// a later run can leave the output alone while none of it changed
+class Manifest
+{
+public:
+
+  Manifest();
+  ~Manifest();
+
+  // a file read by the run, which may not exist
+  void file(std::string const& path);
+
+  // a file that does not change while the process runs, such as the program itself,
+  // hashed once per process
+  void binary(std::string const& path);
+
+  // an environment variable read by the run, which may not be set
+  void env(std::string const& name);
+
+  // a macro whose result can change between runs with nothing else changed,
+  // such as one that runs a program or sends a request, its output is never fresh
+  void unstable(std::string const& name);
+
+  // any other value the output depends on, such as the options
+  void value(std::string const& key, std::string const& val);
+
+  // where the manifest of an output is kept
+  static std::string path(std::string const& ofile);
+
+  // write the manifest of an output, with the current state of what it read
+  void save(std::string const& ofile) const;
+
+  // whether the output, the files and environment variables in its manifest,
+  // and the values of this manifest, are unchanged since it was saved
+  bool fresh(std::string const& ofile) const;
+
+private:
+
+  // the sha256 of a file, empty when it does not exist
+  static std::string hash(std::string const& path);
+
+  // the hash of a file, computed once per process for a binary
+  std::string file_hash(std::string const& path) const;
+
+  std::set<std::string> files_;
+  std::set<std::string> binaries_;
+  std::set<std::string> env_;
+  std::set<std::string> unstable_;
+  std::map<std::string, std::string> values_;
+}; // class Manifest
+
+#endif // M8_MANIFEST_HH
@@ -0,0 +1,441 @@
+#include "m8/matcher.hh"
+
+#include <cstddef>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+Matcher::Matcher()
+{
+}
+
+Matcher::~Matcher()
+{
+}
+
+bool Matcher::empty() const
+{
+  return ! valid_;
+}
+
+bool Matcher::compile(std::string const& pattern)
+{
+  prog_.clear();
+  valid_ = false;
+
+  // an empty pattern selects the built-in argument validation
+  if (pattern.empty())
+  {
+    return false;
+  }
+
+  std::unordered_map<std::string, Op> const tokens {
+    {"ws", Op::ws},
+    {"!all", Op::all},
+    {"!txt", Op::txt},
+    {"!wrd", Op::wrd},
+    {"!num", Op::num},
+    {"!str_s", Op::str_s},
+    {"!str_d", Op::str_d},
+    {"M8!", Op::open},
+    {"!8M", Op::close},
+  };
+
+  std::string const meta {"^$\\.*+?()[]{}|"};
+
+  std::string lit;
+  bool begin {true};
+  bool end {false};
+
+  auto const push = [&](Op op) {
+    if (! lit.empty())
+    {
+      prog_.push_back({Op::lit, lit});
+      lit.clear();
+    }
+    prog_.push_back({op, {}});
+  };
+
+  for (std::size_t i = 0; i < pattern.size(); ++i)
+  {
+    if (end)
+    {
+      prog_.clear();
+      return false;
+    }
+
+    char const c {pattern.at(i)};
+
+    if (c == '{')
+    {
+      auto const pos = pattern.find('}', i);
+      if (pos == std::string::npos)
+      {
+        prog_.clear();
+        return false;
+      }
+      auto name = pattern.substr(i + 1, pos - i - 1);
+      name = name.substr(0, name.find(':'));
+      i = pos;
+
+      if (name == "b" && begin)
+      {
+        continue;
+      }
+
+      if (name == "e")
+      {
+        end = true;
+        continue;
+      }
+
+      if ((name == "empty" || name == "void") && begin)
+      {
+        end = true;
+        continue;
+      }
+
+      auto const it = tokens.find(name);
+      if (it == tokens.end())
+      {
+        prog_.clear();
+        return false;
+      }
+
+      push(it->second);
+      begin = false;
+      end = (it->second == Op::close);
+      continue;
+    }
+
+    if (c == '^' && begin)
+    {
+      continue;
+    }
+
+    if (c == '$')
+    {
+      end = true;
+      continue;
+    }
+
+    if (meta.find(c) != std::string::npos)
+    {
+      prog_.clear();
+      return false;
+    }
+
+    lit += c;
+    begin = false;
+  }
+
+  if (! lit.empty())
+  {
+    prog_.push_back({Op::lit, lit});
+  }
+
+  if (! validate())
+  {
+    prog_.clear();
+    return false;
+  }
+
+  valid_ = true;
+
+  return true;
+}
+
+bool Matcher::validate() const
+{
+  // only accept sequences where each token has a single possible
+  // match length, apart from a trailing '{!all}' or '{!txt}'
+  for (std::size_t i = 0; i < prog_.size(); ++i)
+  {
+    auto const op = prog_.at(i).op;
+    Node const* next {i + 1 < prog_.size() ? &prog_.at(i + 1) : nullptr};
+
+    switch (op)
+    {
+      case Op::ws:
+      {
+        if (next && (next->op == Op::ws ||
+          (next->op == Op::lit && std::string_view(" \t\n\v\f\r").find(next->str.front()) != std::string_view::npos)))
+        {
+          return false;
+        }
+        break;
+      }
+
+      case Op::wrd:
+      case Op::num:
+      {
+        if (next && next->op != Op::ws)
+        {
+          return false;
+        }
+        break;
+      }
+
+      case Op::all:
+      case Op::txt:
+      {
+        if (next && next->op != Op::close)
+        {
+          return false;
+        }
+        break;
+      }
+
+      case Op::open:
+      {
+        if (! next || (next->op != Op::all && next->op != Op::txt))
+        {
+          return false;
+        }
+        break;
+      }
+
+      case Op::close:
+      {
+        if (i == 0 || next ||
+          (prog_.at(i - 1).op != Op::all && prog_.at(i - 1).op != Op::txt))
+        {
+          return false;
+        }
+        break;
+      }
+
+      default:
+      {
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Matcher::match(std::string const& str, std::vector<std::string>& res) const
+{
+  auto const is_space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+  };
+
+  auto const is_digit = [](char c) {
+    return c >= '0' && c <= '9';
+  };
+
+  std::string_view const view {str};
+  std::size_t const size {view.size()};
+  std::size_t pos {0};
+
+  // start of the '{ws}' run directly before the current token
+  std::size_t ws {std::string_view::npos};
+
+  res.clear();
+  res.emplace_back(str);
+
+  auto const fail = [&]() {
+    res.clear();
+    return false;
+  };
+
+  for (std::size_t i = 0; i < prog_.size(); ++i)
+  {
+    auto const& e = prog_.at(i);
+    std::size_t const begin {pos};
+
+    switch (e.op)
+    {
+      case Op::lit:
+      {
+        if (view.substr(pos, e.str.size()) != e.str)
+        {
+          return fail();
+        }
+        pos += e.str.size();
+        break;
+      }
+
+      case Op::ws:
+      {
+        while (pos < size && is_space(view[pos]))
+        {
+          ++pos;
+        }
+        if (pos == begin)
+        {
+          return fail();
+        }
+        ws = begin;
+        continue;
+      }
+
+      case Op::wrd:
+      {
+        while (pos < size && ! is_space(view[pos]))
+        {
+          ++pos;
+        }
+        if (pos == begin)
+        {
+          return fail();
+        }
+        res.emplace_back(view.substr(begin, pos - begin));
+        break;
+      }
+
+      case Op::num:
+      {
+        if (pos < size && (view[pos] == '-' || view[pos] == '+'))
+        {
+          ++pos;
+        }
+        std::size_t const digits {pos};
+        while (pos < size && is_digit(view[pos]))
+        {
+          ++pos;
+        }
+        if (pos == digits)
+        {
+          return fail();
+        }
+        if (pos + 1 < size && view[pos] == '.' && is_digit(view[pos + 1]))
+        {
+          pos += 2;
+          while (pos < size && is_digit(view[pos]))
+          {
+            ++pos;
+          }
+        }
+        if (pos < size && view[pos] == 'e')
+        {
+          std::size_t exp {pos + 1};
+          if (exp < size && (view[exp] == '-' || view[exp] == '+'))
+          {
+            ++exp;
+          }
+          if (exp < size && is_digit(view[exp]))
+          {
+            pos = exp;
+            while (pos < size && is_digit(view[pos]))
+            {
+              ++pos;
+            }
+          }
+        }
+        res.emplace_back(view.substr(begin, pos - begin));
+        break;
+      }
+
+      case Op::str_s:
+      case Op::str_d:
+      {
+        char const quote {e.op == Op::str_s ? '\'' : '"'};
+        if (pos >= size || view[pos] != quote)
+        {
+          return fail();
+        }
+        ++pos;
+        while (pos < size && view[pos] != quote)
+        {
+          if (view[pos] == '\\')
+          {
+            // an escape can not be followed by a line terminator
+            if (pos + 1 >= size || view[pos + 1] == '\n' || view[pos + 1] == '\r')
+            {
+              return fail();
+            }
+            ++pos;
+          }
+          ++pos;
+        }
+        if (pos >= size)
+        {
+          return fail();
+        }
+        res.emplace_back(view.substr(begin + 1, pos - begin - 1));
+        ++pos;
+        break;
+      }
+
+      case Op::open:
+      case Op::all:
+      case Op::txt:
+      {
+        if (match_tail(view.substr(pos), i, res))
+        {
+          return true;
+        }
+
+        // '{ws}' gives back its last char when the tail needs one
+        if (ws != std::string_view::npos && pos == size && pos - ws > 1 &&
+          match_tail(view.substr(pos - 1), i, res))
+        {
+          return true;
+        }
+
+        return fail();
+      }
+
+      default:
+      {
+        return fail();
+      }
+    }
+
+    ws = std::string_view::npos;
+  }
+
+  if (pos != size)
+  {
+    return fail();
+  }
+
+  return true;
+}
+
+bool Matcher::match_tail(std::string_view str, std::size_t node, std::vector<std::string>& res) const
+{
+  bool const open {prog_.at(node).op == Op::open};
+  if (open)
+  {
+    ++node;
+  }
+
+  std::size_t const min {prog_.at(node).op == Op::txt ? 1ul : 0ul};
+  bool const close {node + 1 < prog_.size()};
+
+  // the lazy capture stops at the first point where the rest matches,
+  // which is either before a trailing '!8M' or at the end
+  auto const capture = [&](std::string_view s) {
+    std::size_t len {s.size()};
+
+    if (close && len >= min + 3 && s.substr(len - 3) == "!8M")
+    {
+      len -= 3;
+    }
+    else if (len < min)
+    {
+      return false;
+    }
+
+    if (s.substr(0, len).find('\r') != std::string_view::npos)
+    {
+      return false;
+    }
+
+    res.emplace_back(s.substr(0, len));
+
+    return true;
+  };
+
+  if (open && str.substr(0, 3) == "M8!" && capture(str.substr(3)))
+  {
+    return true;
+  }
+
+  return capture(str);
+}
@@ -0,0 +1,58 @@
+#ifndef M8_MATCHER_HH
+#define M8_MATCHER_HH
+
+#include <cstddef>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// linear time matcher for argument patterns built only from
+// rx_grammar_ tokens and literal text
+class Matcher
+{
+public:
+
+  Matcher();
+  ~Matcher();
+
+  // compile an unformatted pattern such as '{b}{!str_s}{ws}{!all}{e}'
+  // returns false if the pattern needs the regex engine
+  bool compile(std::string const& pattern);
+
+  // match the complete string
+  // res is filled like a std::smatch, full match first then each capture
+  bool match(std::string const& str, std::vector<std::string>& res) const;
+
+  bool empty() const;
+
+private:
+
+  enum class Op
+  {
+    lit,
+    ws,
+    all,
+    txt,
+    wrd,
+    num,
+    str_s,
+    str_d,
+    open,
+    close,
+  };
+
+  struct Node
+  {
+    Op op;
+    std::string str;
+  };
+
+  bool validate() const;
+  bool match_tail(std::string_view str, std::size_t node, std::vector<std::string>& res) const;
+
+  std::vector<Node> prog_;
+  bool valid_ {false};
+}; // class Matcher
+
+#endif // M8_MATCHER_HH
@@ -0,0 +1,307 @@
+#include "m8/mem_stats.hh"
+
+#include "ob/term.hh"
+namespace aec = OB::Term::ANSI_Escape_Codes;
+
+#include <sys/resource.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+
+namespace Mem_Stats
+{
+
+struct Slot
+{
+  std::atomic<std::uint64_t> count {0};
+  std::atomic<std::uint64_t> bytes {0};
+}; // struct Slot
+
+static std::atomic<bool> enabled_ {false};
+
+// allocations made outside of any scope
+static Slot other_;
+
+// heap in use since counting was enabled, and its high water mark
+static std::atomic<std::int64_t> live_ {0};
+static std::atomic<std::int64_t> peak_ {0};
+
+static thread_local Slot* current_ {nullptr};
+// set while the registry itself allocates
+static thread_local bool paused_ {false};
+
+// tags are never removed, so slot pointers stay valid
+static std::map<std::string, Slot>& slots()
+{
+  static std::map<std::string, Slot> slots;
+  return slots;
+}
+
+static std::mutex& slots_mtx()
+{
+  static std::mutex mtx;
+  return mtx;
+}
+
+static void on_alloc(void* ptr, std::size_t size)
+{
+  if (paused_)
+  {
+    return;
+  }
+
+  auto& slot = current_ ? *current_ : other_;
+  slot.count.fetch_add(1, std::memory_order_relaxed);
+  slot.bytes.fetch_add(size, std::memory_order_relaxed);
+
+  auto const live = live_.fetch_add(static_cast<std::int64_t>(malloc_usable_size(ptr)),
+    std::memory_order_relaxed) + static_cast<std::int64_t>(malloc_usable_size(ptr));
+  auto peak = peak_.load(std::memory_order_relaxed);
+  while (live > peak && ! peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+  {
+  }
+}
+
+// calls the new handler until the allocation succeeds, as operator new must,
+// an align of 0 uses the default alignment
+static void* allocate(std::size_t size, std::size_t align)
+{
+  auto n = size ? size : 1;
+  if (align)
+  {
+    // aligned_alloc takes a size that is a multiple of the alignment
+    n = (n + align - 1) / align * align;
+  }
+
+  for (;;)
+  {
+    void* ptr {align ? std::aligned_alloc(align, n) : std::malloc(n)};
+    if (ptr)
+    {
+      if (enabled())
+      {
+        on_alloc(ptr, size);
+      }
+      return ptr;
+    }
+
+    auto const handler = std::get_new_handler();
+    if (! handler)
+    {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+static void on_free(void* ptr)
+{
+  live_.fetch_sub(static_cast<std::int64_t>(malloc_usable_size(ptr)), std::memory_order_relaxed);
+}
+
+Scope::Scope(char const* tag)
+{
+  if (enabled())
+  {
+    paused_ = true;
+    begin(tag);
+    paused_ = false;
+  }
+}
+
+Scope::Scope(char const* prefix, std::string const& name)
+{
+  if (enabled())
+  {
+    paused_ = true;
+    begin(prefix + name);
+    paused_ = false;
+  }
+}
+
+Scope::~Scope()
+{
+  if (active_)
+  {
+    current_ = prev_;
+  }
+}
+
+void Scope::begin(std::string const& tag)
+{
+  Slot* slot {nullptr};
+  {
+    std::lock_guard<std::mutex> lock {slots_mtx()};
+    slot = &slots()[tag];
+  }
+
+  prev_ = current_;
+  current_ = slot;
+  active_ = true;
+}
+
+void enable()
+{
+  enabled_ = true;
+}
+
+bool enabled()
+{
+  return enabled_.load(std::memory_order_relaxed);
+}
+
+std::string str()
+{
+  paused_ = true;
+
+  std::ostringstream oss;
+  OB::Term::ostream ss {oss, 2};
+  if (OB::Term::is_term(STDERR_FILENO))
+  {
+    ss.width(OB::Term::width(STDERR_FILENO));
+  }
+  else
+  {
+    ss.line_wrap(false);
+    ss.escape_codes(false);
+  }
+
+  std::vector<std::pair<std::string, Slot const*>> rows;
+  std::size_t width {5};
+  {
+    std::lock_guard<std::mutex> lock {slots_mtx()};
+    for (auto const& [key, val] : slots())
+    {
+      rows.emplace_back(key, &val);
+      width = std::max(width, key.size());
+    }
+  }
+  rows.emplace_back("other", &other_);
+
+  // largest first
+  std::sort(rows.begin(), rows.end(), [](auto const& lhs, auto const& rhs) {
+    return lhs.second->bytes > rhs.second->bytes;
+  });
+
+  auto const col = [](auto const& val, int w) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3) << std::setw(w) << val;
+    return os.str();
+  };
+
+  auto const mb = [](std::uint64_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+  };
+
+  std::ostringstream head;
+  head
+  << std::left << std::setw(static_cast<int>(width)) << "tag" << std::right
+  << col("allocs", 12) << col("MB", 12) << col("avg B", 10);
+
+  ss
+  << aec::wrap("Memory\n", aec::fg_white)
+  << OB::Term::iomanip::push()
+  << aec::wrap(head.str(), aec::fg_white) << "\n";
+
+  std::uint64_t count {0};
+  std::uint64_t bytes {0};
+  for (auto const& [key, val] : rows)
+  {
+    auto const c = val->count.load();
+    auto const b = val->bytes.load();
+    if (c == 0)
+    {
+      continue;
+    }
+    count += c;
+    bytes += b;
+
+    std::ostringstream name;
+    name << std::left << std::setw(static_cast<int>(width)) << key;
+
+    ss
+    << aec::wrap(name.str(), aec::fg_magenta)
+    << aec::wrap(col(c, 12) + col(mb(b), 12) + col(b / c, 10), aec::fg_green)
+    << "\n";
+  }
+
+  std::ostringstream total;
+  total << std::left << std::setw(static_cast<int>(width)) << "total";
+
+  // ru_maxrss is in kilobytes on linux
+  std::uint64_t rss {0};
+  rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+  {
+    rss = static_cast<std::uint64_t>(ru.ru_maxrss) * 1024;
+  }
+
+  ss
+  << aec::wrap(total.str(), aec::fg_magenta)
+  << aec::wrap(col(count, 12) + col(mb(bytes), 12) + col(count ? bytes / count : 0, 10), aec::fg_green)
+  << "\n"
+  << aec::wrap("peak heap MB ", aec::fg_magenta)
+  << aec::wrap(col(mb(static_cast<std::uint64_t>(std::max<std::int64_t>(peak_, 0))), 0), aec::fg_green)
+  << "\n"
+  << aec::wrap("peak rss MB  ", aec::fg_magenta)
+  << aec::wrap(col(mb(rss), 0), aec::fg_green)
+  << "\n"
+  << OB::Term::iomanip::pop();
+
+  paused_ = false;
+
+  return oss.str();
+}
+
+} // namespace Mem_Stats
+
+// replaced global allocation functions, the array and nothrow forms forward to these
+
+void* operator new(std::size_t size)
+{
+  return Mem_Stats::allocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+  return Mem_Stats::allocate(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept
+{
+  if (ptr && Mem_Stats::enabled())
+  {
+    Mem_Stats::on_free(ptr);
+  }
+
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+  operator delete(ptr);
+}
@@ -0,0 +1,42 @@
+#ifndef M8_MEM_STATS_HH
+#define M8_MEM_STATS_HH
+
+#include <string>
+
+// heap allocation counts for the --mem-stats report,
+// gathered by the replaced global operator new
+namespace Mem_Stats
+{
+
+  struct Slot;
+
+  // allocations made on this thread while a scope is alive are counted
+  // against its tag, the innermost scope wins
+  class Scope
+  {
+  public:
+
+    explicit Scope(char const* tag);
+    Scope(char const* prefix, std::string const& name);
+    ~Scope();
+
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+
+  private:
+
+    void begin(std::string const& tag);
+
+    Slot* prev_ {nullptr};
+    bool active_ {false};
+  }; // class Scope
+
+  // counting is off until enabled, and stays on once it is
+  void enable();
+  bool enabled();
+
+  std::string str();
+
+} // namespace Mem_Stats
+
+#endif // M8_MEM_STATS_HH
@@ -0,0 +1,178 @@
+#include "m8/profiler.hh"
+
+#include "m8/ast.hh"
+
+#include "ob/term.hh"
+namespace aec = OB::Term::ANSI_Escape_Codes;
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <array>
+#include <map>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+
+Profiler::Scope::Scope(Profiler* profiler, Tmacro const& macro) :
+  profiler_ {profiler},
+  macro_ {macro}
+{
+  if (profiler_)
+  {
+    profiler_->begin();
+    start_ = clock::now();
+  }
+}
+
+Profiler::Scope::~Scope()
+{
+  if (profiler_)
+  {
+    auto const time = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count();
+    profiler_->end(macro_, time);
+  }
+}
+
+Profiler::Profiler()
+{
+}
+
+Profiler::~Profiler()
+{
+}
+
+void Profiler::begin()
+{
+  nested_.emplace_back(0);
+}
+
+void Profiler::end(Tmacro const& macro, std::int64_t time)
+{
+  auto const nested = nested_.back();
+  nested_.pop_back();
+
+  // a macro such as m8:include runs other macros during its call
+  if (! nested_.empty())
+  {
+    nested_.back() += time;
+  }
+
+  auto& e = entries_[{macro.name, macro.fn_index}];
+  ++e.count;
+  e.inclusive += time;
+  e.exclusive += time - nested;
+  e.args += macro.args.size();
+  e.res += macro.res.size();
+  ++e.hist.at(bucket(time));
+}
+
+std::size_t Profiler::bucket(std::int64_t time)
+{
+  auto const ns = static_cast<std::uint64_t>(std::max<std::int64_t>(time, 0));
+  if (ns < 16)
+  {
+    return ns;
+  }
+  auto const msb = static_cast<std::size_t>(63 - __builtin_clzll(ns));
+  return msb * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+std::int64_t Profiler::percentile(Entry const& e, double p)
+{
+  auto const rank = static_cast<std::uint64_t>(p * static_cast<double>(e.count) + 0.5);
+  std::uint64_t sum {0};
+  for (std::size_t i = 0; i < e.hist.size(); ++i)
+  {
+    sum += e.hist.at(i);
+    if (sum >= std::max<std::uint64_t>(rank, 1))
+    {
+      // upper bound of the bucket
+      if (i < 16)
+      {
+        return static_cast<std::int64_t>(i);
+      }
+      auto const msb = i / 4;
+      return static_cast<std::int64_t>(((4 + i % 4 + 1) << (msb - 2)) - 1);
+    }
+  }
+  return 0;
+}
+
+std::string Profiler::str() const
+{
+  std::ostringstream oss;
+  OB::Term::ostream ss {oss, 2};
+  if (OB::Term::is_term(STDERR_FILENO))
+  {
+    ss.width(OB::Term::width(STDERR_FILENO));
+  }
+  else
+  {
+    ss.line_wrap(false);
+    ss.escape_codes(false);
+  }
+
+  std::vector<decltype(entries_)::value_type const*> rows;
+  std::size_t width {5};
+  for (auto const& e : entries_)
+  {
+    rows.emplace_back(&e);
+    width = std::max(width, e.first.first.size());
+  }
+
+  // most expensive first
+  std::sort(rows.begin(), rows.end(), [](auto const& lhs, auto const& rhs) {
+    return lhs->second.exclusive > rhs->second.exclusive;
+  });
+
+  auto const col = [](auto const& val, int w) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3) << std::setw(w) << val;
+    return os.str();
+  };
+
+  auto const ms = [](std::int64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+  };
+
+  std::ostringstream head;
+  head
+  << std::left << std::setw(static_cast<int>(width)) << "macro" << std::right
+  << col("idx", 4) << col("calls", 10)
+  << col("incl ms", 12) << col("excl ms", 12)
+  << col("p50 ms", 10) << col("p99 ms", 10)
+  << col("args B", 12) << col("res B", 12);
+
+  ss
+  << aec::wrap("Profile\n", aec::fg_white)
+  << OB::Term::iomanip::push()
+  << aec::wrap(head.str(), aec::fg_white) << "\n";
+
+  for (auto const& e : rows)
+  {
+    auto const& [key, val] = *e;
+
+    std::ostringstream name;
+    name << std::left << std::setw(static_cast<int>(width)) << key.first;
+
+    ss
+    << aec::wrap(name.str(), aec::fg_magenta)
+    << aec::wrap(
+      col(key.second, 4) + col(val.count, 10) +
+      col(ms(val.inclusive), 12) + col(ms(val.exclusive), 12) +
+      col(ms(percentile(val, 0.50)), 10) + col(ms(percentile(val, 0.99)), 10) +
+      col(val.args, 12) + col(val.res, 12), aec::fg_green)
+    << "\n";
+  }
+
+  ss << OB::Term::iomanip::pop();
+
+  return oss.str();
+}
@@ -0,0 +1,71 @@
+#ifndef M8_PROFILER_HH
+#define M8_PROFILER_HH
+
+#include "m8/ast.hh"
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <chrono>
+#include <utility>
+
+// per macro and overload call times, for the --profile report
+class Profiler
+{
+public:
+
+  using clock = std::chrono::steady_clock;
+
+  // times one macro call, from construction to destruction
+  // a null profiler makes it a no-op
+  class Scope
+  {
+  public:
+
+    Scope(Profiler* profiler, Tmacro const& macro);
+    ~Scope();
+
+  private:
+
+    Profiler* profiler_;
+    Tmacro const& macro_;
+    clock::time_point start_;
+  }; // class Scope
+
+  Profiler();
+  ~Profiler();
+
+  std::string str() const;
+
+private:
+
+  // latency histogram, four buckets per power of two nanoseconds
+  using Hist = std::array<std::uint32_t, 256>;
+
+  struct Entry
+  {
+    std::uint64_t count {0};
+    std::int64_t inclusive {0};
+    std::int64_t exclusive {0};
+    std::uint64_t args {0};
+    std::uint64_t res {0};
+    Hist hist {};
+  }; // struct Entry
+
+  void begin();
+  void end(Tmacro const& macro, std::int64_t time);
+
+  static std::size_t bucket(std::int64_t time);
+  static std::int64_t percentile(Entry const& e, double p);
+
+  std::map<std::pair<std::string, std::size_t>, Entry> entries_;
+
+  // time spent in nested calls, for each active call
+  std::vector<std::int64_t> nested_;
+}; // class Profiler
+
+#endif // M8_PROFILER_HH
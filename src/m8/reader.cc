@@ -5,16 +5,22 @@ namespace aec = OB::Term::ANSI_Escape_Codes;
 
 #include "lib/linenoise.hh"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cctype>
 #include <cstdint>
 #include <cstddef>
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <map>
+#include <algorithm>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -53,6 +59,11 @@ Reader::Reader()
 
 Reader::~Reader()
 {
+  if (map_)
+  {
+    ::munmap(const_cast<char*>(map_), map_size_);
+  }
+
   if (readline_)
   {
     linenoise::SaveHistory(history_.c_str());
@@ -61,24 +72,89 @@ Reader::~Reader()
 
 void Reader::open(std::string const& file_name)
 {
+  readline_ = false;
+
+  // map regular files, everything else is read as a stream
+  int const fd {::open(file_name.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (fd != -1)
+  {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+      map_size_ = static_cast<std::size_t>(st.st_size);
+      if (map_size_ == 0)
+      {
+        mapped_ = true;
+      }
+      else
+      {
+        void* ptr {::mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0)};
+        if (ptr != MAP_FAILED)
+        {
+          ::madvise(ptr, map_size_, MADV_SEQUENTIAL);
+          map_ = static_cast<char const*>(ptr);
+          mapped_ = true;
+        }
+      }
+    }
+    ::close(fd);
+
+    if (mapped_)
+    {
+      return;
+    }
+    map_size_ = 0;
+  }
+
   ifile_.open(file_name);
   if (! ifile_.is_open())
   {
     throw std::runtime_error("could not open the input file");
   }
-  lines_[0] = 0;
-  readline_ = false;
 }
 
 std::string Reader::line()
 {
-  return line_;
+  return std::string(line_);
 }
 
-bool Reader::next(std::string& str)
+bool Reader::next(std::string_view& str)
+{
+  if (mapped_)
+  {
+    return next_map(str);
+  }
+
+  return next_stream(str);
+}
+
+bool Reader::next_map(std::string_view& str)
+{
+  if (pos_ >= map_size_)
+  {
+    return false;
+  }
+
+  ++row_;
+
+  std::string_view const map {map_, map_size_};
+  auto end = map.find('\n', pos_);
+  if (end == std::string_view::npos)
+  {
+    end = map_size_;
+  }
+
+  str = map.substr(pos_, end - pos_);
+  line_ = str;
+  pos_ = end + 1;
+  bytes_ = std::min(pos_, map_size_);
+
+  return true;
+}
+
+bool Reader::next_stream(std::string_view& str)
 {
   ++row_;
-  lines_[row_] = ifile_.tellg();
   bool status {false};
 
   if (readline_)
@@ -96,7 +172,9 @@ bool Reader::next(std::string& str)
     else
     {
       linenoise::AddHistory(input.c_str());
-      str = input;
+      buf_ = std::move(input);
+      bytes_ += buf_.size() + 1;
+      str = buf_;
       line_ = str;
       status = true;
     }
@@ -105,8 +183,10 @@ bool Reader::next(std::string& str)
   }
   else
   {
-    if (std::getline(ifile_, str))
+    if (std::getline(ifile_, buf_))
     {
+      bytes_ += buf_.size() + (ifile_.eof() ? 0 : 1);
+      str = buf_;
       line_ = str;
       status = true;
     }
@@ -120,6 +200,11 @@ bool Reader::next(std::string& str)
   }
 }
 
+std::size_t Reader::bytes() const
+{
+  return bytes_;
+}
+
 std::uint32_t Reader::row()
 {
   return row_;
@@ -5,10 +5,10 @@
 #include <cstddef>
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iostream>
 #include <fstream>
-#include <map>
 #include <vector>
 
 class Reader
@@ -19,31 +19,43 @@ public:
   ~Reader();
 
   void open(std::string const& file_name);
-  bool next(std::string& str);
+  bool next(std::string_view& str);
   std::uint32_t row();
   std::uint32_t col();
   std::string line();
+  std::size_t bytes() const;
 
 private:
 
+  bool next_map(std::string_view& str);
+  bool next_stream(std::string_view& str);
+
   bool readline_ {true};
 
   std::string history_ {"~/.m8-history"};
   std::string prompt_;
   std::vector<std::string> examples {"floor", "find", "read", "round", "print!"};
 
-  // input file stream
+  // input file stream, used when the file can not be mapped
   std::ifstream ifile_;
 
+  // input file mapped into memory
+  char const* map_ {nullptr};
+  std::size_t map_size_ {0};
+  bool mapped_ {false};
+  // position of the next line in the mapping
+  std::size_t pos_ {0};
+
   // current row number
   std::uint32_t row_ {0};
   // current column number
   std::uint32_t col_ {0};
-  // current line
-  std::string line_;
-
-  // stores file position to line number
-  std::map<std::size_t, std::uint32_t> lines_;
+  // bytes consumed from the input
+  std::size_t bytes_ {0};
+  // current line, points into the mapping or into buf_
+  std::string_view line_;
+  // storage for the current line when it is not mapped
+  std::string buf_;
 }; // class Reader
 
 #endif // M8_READER_HH
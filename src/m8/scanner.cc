@@ -0,0 +1,96 @@
+#include "m8/scanner.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define M8_SCANNER_X86
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+
+Scanner::Scanner(std::string const& delim_start, std::string const& delim_end) :
+  start_ {delim_start.at(0)},
+  end_ {delim_end.at(0)}
+{
+#if defined(M8_SCANNER_X86)
+  // avx2 is selected at runtime, so a generic build still uses it
+  avx2_ = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+Scanner::~Scanner()
+{
+}
+
+std::size_t Scanner::next(std::string_view str, std::size_t pos) const
+{
+  if (avx2_)
+  {
+    return next_avx2(str.data(), str.size(), pos);
+  }
+
+  return next_sse2(str.data(), str.size(), pos);
+}
+
+#if defined(M8_SCANNER_X86)
+__attribute__((target("avx2")))
+#endif
+std::size_t Scanner::next_avx2(char const* str, std::size_t size, std::size_t pos) const
+{
+#if defined(M8_SCANNER_X86)
+  __m256i const start {_mm256_set1_epi8(start_)};
+  __m256i const end {_mm256_set1_epi8(end_)};
+
+  for (; pos + 32 <= size; pos += 32)
+  {
+    __m256i const chunk {_mm256_loadu_si256(reinterpret_cast<__m256i const*>(str + pos))};
+    auto const mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, start), _mm256_cmpeq_epi8(chunk, end))));
+
+    if (mask != 0)
+    {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+
+  return next_sse2(str, size, pos);
+}
+
+std::size_t Scanner::next_sse2(char const* str, std::size_t size, std::size_t pos) const
+{
+#if defined(__SSE2__)
+  __m128i const start {_mm_set1_epi8(start_)};
+  __m128i const end {_mm_set1_epi8(end_)};
+
+  for (; pos + 16 <= size; pos += 16)
+  {
+    __m128i const chunk {_mm_loadu_si128(reinterpret_cast<__m128i const*>(str + pos))};
+    auto const mask = static_cast<std::uint32_t>(_mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, start), _mm_cmpeq_epi8(chunk, end))));
+
+    if (mask != 0)
+    {
+      return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+    }
+  }
+#endif
+
+  return next_scalar(str, size, pos);
+}
+
+std::size_t Scanner::next_scalar(char const* str, std::size_t size, std::size_t pos) const
+{
+  for (; pos < size; ++pos)
+  {
+    if (str[pos] == start_ || str[pos] == end_)
+    {
+      return pos;
+    }
+  }
+
+  return size;
+}
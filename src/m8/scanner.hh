@@ -0,0 +1,33 @@
+#ifndef M8_SCANNER_HH
+#define M8_SCANNER_HH
+
+#include <cstddef>
+
+#include <string>
+#include <string_view>
+
+// finds the next position in a line that may begin a delimiter,
+// so that the plain text before it can be handled as a single span
+class Scanner
+{
+public:
+
+  Scanner(std::string const& delim_start, std::string const& delim_end);
+  ~Scanner();
+
+  // index of the next candidate delimiter char at or after pos,
+  // or str.size() if there is none
+  std::size_t next(std::string_view str, std::size_t pos) const;
+
+private:
+
+  std::size_t next_avx2(char const* str, std::size_t size, std::size_t pos) const;
+  std::size_t next_sse2(char const* str, std::size_t size, std::size_t pos) const;
+  std::size_t next_scalar(char const* str, std::size_t size, std::size_t pos) const;
+
+  char start_;
+  char end_;
+  bool avx2_ {false};
+}; // class Scanner
+
+#endif // M8_SCANNER_HH
@@ -0,0 +1,251 @@
+#include "m8/skeleton.hh"
+
+#include "ob/string.hh"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <stdexcept>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+Skeleton::Skeleton()
+{
+}
+
+Skeleton::~Skeleton()
+{
+}
+
+std::string Skeleton::path(std::string const& ifile)
+{
+  return ".m8/skel/" + OB::String::url_encode(ifile) + ".bin";
+}
+
+// the file is a list of sizes and strings, each size a native std::size_t,
+// the header names their width and byte order, so a file written
+// on another architecture is started over instead of misread
+namespace
+{
+
+std::string magic()
+{
+  std::uint16_t const one {1};
+  bool const little {*reinterpret_cast<unsigned char const*>(&one) == 1};
+  return "m8 skeleton 1 " + std::to_string(sizeof(std::size_t)) + (little ? " le\n" : " be\n");
+}
+
+void put(std::string& buf, std::size_t val)
+{
+  buf.append(reinterpret_cast<char const*>(&val), sizeof(val));
+}
+
+void put(std::string& buf, std::string const& str)
+{
+  put(buf, str.size());
+  buf.append(str);
+}
+
+void put(std::string& buf, std::vector<std::string> const& vec)
+{
+  put(buf, vec.size());
+  for (auto const& e : vec)
+  {
+    put(buf, e);
+  }
+}
+
+// reads from the front of the view, throwing when it runs out
+struct Input
+{
+  std::string_view str;
+
+  std::size_t size()
+  {
+    if (str.size() < sizeof(std::size_t))
+    {
+      throw std::runtime_error("truncated template cache file");
+    }
+    std::size_t val;
+    std::memcpy(&val, str.data(), sizeof(val));
+    str.remove_prefix(sizeof(val));
+    return val;
+  }
+
+  std::string string()
+  {
+    auto const n = size();
+    if (str.size() < n)
+    {
+      throw std::runtime_error("truncated template cache file");
+    }
+    std::string val {str.substr(0, n)};
+    str.remove_prefix(n);
+    return val;
+  }
+
+  std::vector<std::string> strings()
+  {
+    auto const n = size();
+    // every string takes at least its size
+    if (n > str.size() / sizeof(std::size_t))
+    {
+      throw std::runtime_error("truncated template cache file");
+    }
+    std::vector<std::string> val;
+    val.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      val.emplace_back(string());
+    }
+    return val;
+  }
+}; // struct Input
+
+} // namespace
+
+void Skeleton::load(std::string const& ifile, std::string const& delims)
+{
+  file_ = path(ifile);
+  delims_ = delims;
+  calls_.clear();
+  dirty_ = false;
+
+  std::ifstream file {file_, std::ios::binary};
+  if (! file.is_open())
+  {
+    return;
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+  auto const buf = ss.str();
+
+  // a damaged file, or one made between other delimiters, is started over
+  dirty_ = true;
+  auto const head = magic();
+  if (buf.compare(0, head.size(), head) != 0)
+  {
+    return;
+  }
+  Input in {std::string_view(buf).substr(head.size())};
+  try
+  {
+    if (in.string() != delims_)
+    {
+      return;
+    }
+
+    auto const n = in.size();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      auto str = in.string();
+      Call call;
+      call.name = in.string();
+      call.args = in.string();
+      call.regex = in.strings();
+      call.fn = in.size();
+      call.match = in.strings();
+      calls_.emplace(std::move(str), std::move(call));
+    }
+  }
+  catch (std::exception const&)
+  {
+    calls_.clear();
+    return;
+  }
+  dirty_ = false;
+}
+
+Skeleton::Call* Skeleton::find(std::string const& str)
+{
+  if (str.size() > max_size)
+  {
+    return nullptr;
+  }
+  auto const it = calls_.find(str);
+  if (it == calls_.end())
+  {
+    return nullptr;
+  }
+  it->second.used = true;
+  return &it->second;
+}
+
+void Skeleton::add(std::string const& str, Call call)
+{
+  if (str.size() > max_size)
+  {
+    return;
+  }
+  call.used = true;
+  calls_.insert_or_assign(str, std::move(call));
+  dirty_ = true;
+}
+
+void Skeleton::save() const
+{
+  if (file_.empty())
+  {
+    return;
+  }
+
+  // calls no longer in the input are dropped
+  bool dirty {dirty_};
+  std::size_t count {0};
+  for (auto const& e : calls_)
+  {
+    if (e.second.used)
+    {
+      ++count;
+    }
+    else
+    {
+      dirty = true;
+    }
+  }
+  if (! dirty)
+  {
+    return;
+  }
+
+  std::string buf {magic()};
+  put(buf, delims_);
+  put(buf, count);
+  for (auto const& [str, call] : calls_)
+  {
+    if (! call.used)
+    {
+      continue;
+    }
+    put(buf, str);
+    put(buf, call.name);
+    put(buf, call.args);
+    put(buf, call.regex);
+    put(buf, call.fn);
+    put(buf, call.match);
+  }
+
+  fs::create_directories(fs::path(file_).parent_path());
+
+  auto const tmp = file_ + ".tmp-" + std::to_string(getpid());
+  {
+    std::ofstream file {tmp, std::ios::binary};
+    if (! file.is_open())
+    {
+      throw std::runtime_error("could not write the template cache file");
+    }
+    file << buf;
+  }
+  fs::rename(tmp, file_);
+}
@@ -0,0 +1,63 @@
+#ifndef M8_SKELETON_HH
+#define M8_SKELETON_HH
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// the macro calls of an input file split into name and args, and matched
+// against the regexes of their macro, kept in a file across runs,
+// a later run reuses a call with the same text instead of splitting
+// and matching it again
+class Skeleton
+{
+public:
+
+  struct Call
+  {
+    std::string name;
+    std::string args;
+    // the regexes of the macro when it was matched, in order
+    std::vector<std::string> regex;
+    // the regex that matched, and its groups
+    std::size_t fn {0};
+    std::vector<std::string> match;
+    // found or added during this run
+    bool used {false};
+  }; // struct Call
+
+  // longer calls, such as large def bodies, are split and matched every run,
+  // they are rare and would make up most of the file
+  static std::size_t const max_size {1024};
+
+  Skeleton();
+  ~Skeleton();
+
+  // where the calls of an input file are kept
+  static std::string path(std::string const& ifile);
+
+  // read the calls kept for an input file,
+  // calls found between other delimiters are dropped
+  void load(std::string const& ifile, std::string const& delims);
+
+  // the call with the text between its delimiters, null when not kept or too long
+  Call* find(std::string const& str);
+
+  // keep a call by the text between its delimiters, unless it is too long
+  void add(std::string const& str, Call call);
+
+  // write back the calls used by this run, when they differ from the file
+  void save() const;
+
+private:
+
+  std::string file_;
+  std::string delims_;
+  std::unordered_map<std::string, Call> calls_;
+  // calls were added, or some kept ones went unused
+  bool dirty_ {false};
+}; // class Skeleton
+
+#endif // M8_SKELETON_HH
@@ -0,0 +1,156 @@
+#include "m8/tracer.hh"
+
+#include "lib/json.hh"
+using Json = nlohmann::json;
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <chrono>
+#include <utility>
+#include <stdexcept>
+
+Tracer::Span::Span(Tracer& tracer, std::string name)
+{
+  if (tracer.enabled())
+  {
+    tracer_ = &tracer;
+    tracer_->begin(std::move(name));
+  }
+}
+
+Tracer::Span::~Span()
+{
+  if (tracer_)
+  {
+    tracer_->end();
+  }
+}
+
+void Tracer::Span::name(std::string const& prefix, std::string const& name)
+{
+  if (tracer_)
+  {
+    tracer_->stack_.back().name = prefix + name;
+  }
+}
+
+Tracer::Tracer()
+{
+}
+
+Tracer::~Tracer()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+}
+
+void Tracer::open_trace(std::string const& file_name)
+{
+  trace_.open(file_name, std::ios::trunc);
+  if (! trace_.is_open())
+  {
+    throw std::runtime_error("could not open the trace file");
+  }
+  // microseconds with nanosecond digits, which the default precision
+  // would round once a run is longer than a few seconds
+  trace_ << std::fixed << std::setprecision(3);
+  trace_ << "[\n";
+}
+
+void Tracer::open_folded(std::string const& file_name)
+{
+  folded_file_ = file_name;
+}
+
+bool Tracer::enabled() const
+{
+  return trace_.is_open() || ! folded_file_.empty();
+}
+
+void Tracer::begin(std::string&& name)
+{
+  stack_.push_back({std::move(name), clock::now(), 0});
+}
+
+void Tracer::end()
+{
+  auto const now = clock::now();
+  auto& f = stack_.back();
+  auto const time = std::chrono::duration_cast<std::chrono::nanoseconds>(now - f.start).count();
+
+  if (trace_.is_open())
+  {
+    auto const ts = std::chrono::duration_cast<std::chrono::nanoseconds>(f.start - start_).count();
+
+    if (! first_)
+    {
+      trace_ << ",\n";
+    }
+    first_ = false;
+
+    trace_
+    << "{\"name\":" << Json(f.name).dump()
+    << ",\"cat\":\"m8\",\"ph\":\"X\""
+    << ",\"ts\":" << static_cast<double>(ts) / 1e3
+    << ",\"dur\":" << static_cast<double>(time) / 1e3
+    << ",\"pid\":" << getpid()
+    << ",\"tid\":1}";
+  }
+
+  if (! folded_file_.empty())
+  {
+    std::string path;
+    for (auto const& e : stack_)
+    {
+      if (! path.empty())
+      {
+        path += ";";
+      }
+      path += e.name;
+    }
+    folded_[path] += time - f.nested;
+  }
+
+  stack_.pop_back();
+  if (! stack_.empty())
+  {
+    stack_.back().nested += time;
+  }
+}
+
+void Tracer::close()
+{
+  if (trace_.is_open())
+  {
+    trace_ << "\n]\n";
+    trace_.close();
+  }
+
+  if (! folded_file_.empty())
+  {
+    std::ofstream file {folded_file_, std::ios::trunc};
+    folded_file_.clear();
+    if (! file.is_open())
+    {
+      throw std::runtime_error("could not open the folded trace file");
+    }
+    for (auto const& [key, val] : folded_)
+    {
+      // flamegraph tools take a non-negative integer count
+      file << key << " " << (val > 0 ? val : 0) << "\n";
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef M8_TRACER_HH
+#define M8_TRACER_HH
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <map>
+#include <chrono>
+
+// timeline of the parse phases and macro calls,
+// written as chrome trace events and as folded stacks
+class Tracer
+{
+public:
+
+  using clock = std::chrono::steady_clock;
+
+  // records one span, from construction to destruction
+  // spans opened while it is alive are nested inside it
+  class Span
+  {
+  public:
+
+    Span(Tracer& tracer, std::string name);
+    ~Span();
+
+    Span(Span const&) = delete;
+    Span& operator=(Span const&) = delete;
+
+    // the name can be set once it is known, before any nested span ends
+    void name(std::string const& prefix, std::string const& name);
+
+  private:
+
+    Tracer* tracer_ {nullptr};
+  }; // class Span
+
+  Tracer();
+  ~Tracer();
+
+  // chrome trace event json, viewable in chrome://tracing or perfetto
+  void open_trace(std::string const& file_name);
+
+  // folded stacks with self time in nanoseconds, for flamegraph tools
+  void open_folded(std::string const& file_name);
+
+  bool enabled() const;
+
+  void close();
+
+private:
+
+  struct Frame
+  {
+    std::string name;
+    clock::time_point start;
+    std::int64_t nested {0};
+  }; // struct Frame
+
+  void begin(std::string&& name);
+  void end();
+
+  clock::time_point const start_ {clock::now()};
+
+  std::ofstream trace_;
+  bool first_ {true};
+
+  std::string folded_file_;
+  std::map<std::string, std::int64_t> folded_;
+
+  std::vector<Frame> stack_;
+}; // class Tracer
+
+#endif // M8_TRACER_HH
@@ -1,14 +1,24 @@
 #include "m8/writer.hh"
 
+#include "m8/buffer.hh"
+
 #include "ob/string.hh"
 
 #include "ob/term.hh"
 namespace aec = OB::Term::ANSI_Escape_Codes;
 
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <vector>
 #include <iostream>
-#include <fstream>
+#include <stdexcept>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -19,6 +29,14 @@ Writer::Writer()
 
 Writer::~Writer()
 {
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+
   // if (fs::path(".m8/swp").empty())
   // {
   //   fs::remove_all(".m8/swp");
@@ -35,19 +53,21 @@ void Writer::open(std::string const& file_name)
   file_name_ = file_name;
   fs::path fp {file_name_};
   file_tmp_ = ".m8/swp/" + OB::String::url_encode(fp) + file_ext_;
-  fs::path p {file_tmp_};
-  file_.open(p, std::ios::app);
-  if (! file_.is_open())
+  fd_ = ::open(file_tmp_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ == -1)
   {
     throw std::runtime_error("could not open the output file");
   }
+  buf_.reserve(buf_max_);
 }
 
-void Writer::write(std::string const& str)
+void Writer::write(std::string_view str)
 {
+  bytes_ += str.size();
+
   if (file_name_.empty())
   {
-    std::cout << str;
+    std::cout.write(str.data(), static_cast<std::streamsize>(str.size()));
     if (! str.empty() && str.back() != '\n')
     {
       std::cout << aec::wrap("%\n", aec::reverse) << std::flush;
@@ -55,7 +75,82 @@ void Writer::write(std::string const& str)
   }
   else
   {
-    file_ << str;
+    append(str);
+  }
+}
+
+void Writer::write(Buffer const& buf)
+{
+  bytes_ += buf.size();
+
+  if (file_name_.empty())
+  {
+    for (auto const& e : buf.spans())
+    {
+      std::cout.write(e.data(), static_cast<std::streamsize>(e.size()));
+    }
+    if (! buf.empty() && buf.back() != '\n')
+    {
+      std::cout << aec::wrap("%\n", aec::reverse) << std::flush;
+    }
+  }
+  else
+  {
+    for (auto const& e : buf.spans())
+    {
+      append(e);
+    }
+  }
+}
+
+void Writer::append(std::string_view str)
+{
+  if (str.size() < span_max_)
+  {
+    if (buf_.size() + str.size() > buf_max_)
+    {
+      flush();
+    }
+    buf_.insert(buf_.end(), str.begin(), str.end());
+    return;
+  }
+
+  // write the gathered spans followed by the large span without copying it
+  iovec iov[2] {
+    {buf_.data(), buf_.size()},
+    {const_cast<char*>(str.data()), str.size()},
+  };
+  writev(buf_.empty() ? iov + 1 : iov, buf_.empty() ? 1 : 2);
+  buf_.clear();
+}
+
+void Writer::writev(iovec* iov, int cnt)
+{
+  while (cnt > 0)
+  {
+    auto const n = ::writev(fd_, iov, cnt);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::runtime_error("could not write the output file");
+    }
+
+    // advance past what was written, a short write resumes mid span
+    auto len = static_cast<std::size_t>(n);
+    while (cnt > 0 && len >= iov->iov_len)
+    {
+      len -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0)
+    {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + len;
+      iov->iov_len -= len;
+    }
   }
 }
 
@@ -65,16 +160,25 @@ void Writer::flush()
   {
     std::cout << std::flush;
   }
-  else
+  else if (fd_ != -1 && ! buf_.empty())
   {
-    file_ << std::flush;
+    iovec iov {buf_.data(), buf_.size()};
+    writev(&iov, 1);
+    buf_.clear();
   }
 }
 
+std::size_t Writer::bytes() const
+{
+  return bytes_;
+}
+
 void Writer::close()
 {
-  if (file_.is_open())
+  if (fd_ != -1)
   {
-    file_.close();
+    flush();
+    ::close(fd_);
+    fd_ = -1;
   }
 }
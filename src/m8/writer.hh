@@ -1,10 +1,16 @@
 #ifndef M8_WRITER_HH
 #define M8_WRITER_HH
 
+#include "m8/buffer.hh"
+
+#include <sys/uio.h>
+
+#include <cstddef>
+
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <vector>
 #include <iostream>
-#include <fstream>
 
 class Writer
 {
@@ -14,16 +20,31 @@ public:
   ~Writer();
 
   void open(std::string const& file_name);
-  void write(std::string const& str);
+  void write(std::string_view str);
+  void write(Buffer const& buf);
   void close();
   void flush();
+  std::size_t bytes() const;
 
 private:
 
+  void append(std::string_view str);
+  void writev(iovec* iov, int cnt);
+
+  // spans at least this large are written in place instead of being gathered
+  static std::size_t constexpr span_max_ {4096};
+  static std::size_t constexpr buf_max_ {65536};
+
   std::string file_ext_ {".swp.m8"};
   std::string file_name_;
   std::string file_tmp_;
-  std::ofstream file_;
+  int fd_ {-1};
+
+  // bytes passed to write
+  std::size_t bytes_ {0};
+
+  // small spans waiting to be written to the file
+  std::vector<char> buf_;
 }; // class Writer
 
 #endif // M8_WRITER_HH
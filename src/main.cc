@@ -15,7 +15,14 @@ namespace aec = OB::Term::ANSI_Escape_Codes;
 #include <string>
 #include <iomanip>
 #include <iostream>
+#include <fstream>
+#include <stdexcept>
 #include <algorithm>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -23,6 +30,13 @@ namespace fs = std::filesystem;
 int program_options(OB::Parg& pg);
 int start_m8(OB::Parg& pg);
 std::string mirror_delim(std::string str);
+void write_file(std::string const& file_name, std::string const& str);
+void add_macros(M8& m8);
+void set_options(M8& m8, OB::Parg& pg);
+std::string swap_path(std::string const& ofile);
+fs::path output_path(fs::path const& odir, std::string const& ifile);
+bool fresh(M8& m8, std::vector<std::string> const& ifiles, std::string const& ofile);
+std::size_t run_jobs(M8& total, OB::Parg& pg, std::vector<std::string> const& ifiles);
 
 struct Version
 {
@@ -42,9 +56,11 @@ int program_options(OB::Parg& pg)
 
   pg.usage("[flags] [options] [--] [arguments]");
 
-  pg.usage("['input_file'] [-o|--output 'output_file'] [-c|--config 'config_file'] [[-s|--start 'start_delim'] [-e|--end 'end_delim'] | [-m|--mirror 'mirror_delim']] [--comment 'str'] [--summary] [-t|--timer] [-d|--debug]");
+  pg.usage("['input_file'] [-o|--output 'output_file'] [-c|--config 'config_file'] [[-s|--start 'start_delim'] [-e|--end 'end_delim'] | [-m|--mirror 'mirror_delim']] [--comment 'str'] [--async 'n'] [--batch-compile] [--exit-status] [--incremental] [--template-cache] [--summary] [--profile] [--mem-stats] [-t|--timer] [-d|--debug]");
 
-  pg.usage("[-i|--interactive] [-c|--config 'config_file'] [[-s|--start 'start_delim'] [-e|--end 'end_delim'] | [-m|--mirror 'mirror_delim']] [--comment 'str'] [--summary] [-t|--timer] [-d|--debug]");
+  pg.usage("['input_file'...] -O|--output-dir 'output_dir' [-j|--jobs 'n'] [-c|--config 'config_file'] [[-s|--start 'start_delim'] [-e|--end 'end_delim'] | [-m|--mirror 'mirror_delim']] [--comment 'str'] [--async 'n'] [--batch-compile] [--exit-status] [--incremental] [--template-cache] [--summary] [--mem-stats] [-t|--timer]");
+
+  pg.usage("[-i|--interactive] [-c|--config 'config_file'] [[-s|--start 'start_delim'] [-e|--end 'end_delim'] | [-m|--mirror 'mirror_delim']] [--comment 'str'] [--summary] [--profile] [--mem-stats] [-t|--timer] [-d|--debug]");
 
   pg.usage("[-v|--version]");
   pg.usage("[-h|--help]");
@@ -56,6 +72,7 @@ int program_options(OB::Parg& pg)
     pg.name() + " 'input_file' --output 'ouput_file'",
     pg.name() + " 'input_file' --output 'ouput_file' --start '[[' --end ']]'",
     pg.name() + " 'input_file' --output 'ouput_file' --mirror '[['",
+    pg.name() + " *.m8 --output-dir 'output_dir' --jobs 8",
     pg.name() + " --interactive --mirror '[['",
     pg.name() + " --info 'built_in'",
     pg.name() + " --list",
@@ -84,6 +101,13 @@ int program_options(OB::Parg& pg)
   pg.set("no-copy", "do not copy outside text");
   pg.set("summary", "print out summary at end");
   pg.set("timer,t", "print out execution time in milliseconds");
+  pg.set("profile", "print out the time spent in each macro at end");
+  pg.set("mem-stats", "print out the heap allocations of each parse phase and macro at end");
+  pg.set("no-cache", "do not use the response cache of remote and http macros");
+  pg.set("batch-compile", "compile the top level c and cpp snippets of a file into one program");
+  pg.set("exit-status", "fail a macro when its program exits with a nonzero status, instead of using its output");
+  pg.set("incremental", "leave an output alone when nothing it was made from has changed");
+  pg.set("template-cache", "keep the split and matched macro calls of each input file for later runs");
   // TODO add flag to ignore empty lines
   // pg.set("ignore-empty", "ignore empty lines");
 
@@ -93,11 +117,18 @@ int program_options(OB::Parg& pg)
   // combinable options
   pg.set("config,c", "", "file_name", "the config file");
   pg.set("output,o", "", "file_name", "the output file");
+  pg.set("output-dir,O", "", "dir", "process each input into its own file in dir");
+  pg.set("jobs,j", "0", "n", "parallel jobs for --output-dir, 0 uses every core");
+  pg.set("async", "0", "n", "run up to n external and remote macro calls at once, 0 runs them in order");
   pg.set("start,s", "", "str", "the starting delimiter");
   pg.set("end,e", "", "str", "the ending delimiter");
   pg.set("mirror,m", "", "str", "mirror the delimiter");
   pg.set("ignore", "", "regex", "regex to ignore matching names");
   pg.set("comment", "", "str", "comment symbol");
+  pg.set("trace", "", "file_name", "write a chrome trace of the parse phases and macro calls");
+  pg.set("trace-folded", "", "file_name", "write folded stacks of the parse phases and macro calls");
+  pg.set("metrics-json", "", "file_name", "write the run metrics as json at end");
+  pg.set("metrics-prom", "", "file_name", "write the run metrics as a prometheus textfile at end");
   // TODO add option to control colored output (auto, on, off)
   // pg.set("color", "print output in color");
   // TODO add option to define variable
@@ -154,6 +185,28 @@ int program_options(OB::Parg& pg)
     return -1;
   }
 
+  // the manifest is kept for an output file
+  if (pg.get<bool>("incremental") && ! pg.find("output") && ! pg.find("output-dir"))
+  {
+    std::cerr << pg.help() << "\n";
+    std::cerr << "Error: " << "'--incremental' needs '--output' or '--output-dir'\n";
+    return -1;
+  }
+
+  // each parallel job has its own state, which these would have to share
+  if (pg.find("output-dir"))
+  {
+    for (auto const& e : {"output", "interactive", "profile", "trace", "trace-folded"})
+    {
+      if (pg.find(e))
+      {
+        std::cerr << pg.help() << "\n";
+        std::cerr << "Error: " << "'--" << e << "' can not be used with '--output-dir'\n";
+        return -1;
+      }
+    }
+  }
+
   return 0;
 }
 
@@ -213,83 +266,349 @@ std::string mirror_delim(std::string str)
   return str;
 }
 
-int start_m8(OB::Parg& pg)
+void write_file(std::string const& file_name, std::string const& str)
 {
-  try
+  // write to a temporary file and rename it into place,
+  // so collectors never read a partial file
+  std::string const tmp {file_name + ".tmp"};
   {
-    // init M8 object
-    M8 m8;
+    std::ofstream file {tmp, std::ios::trunc};
+    if (! file.is_open())
+    {
+      throw std::runtime_error("could not open the metrics file");
+    }
+    file << str;
+    if (! file)
+    {
+      throw std::runtime_error("could not write the metrics file");
+    }
+  }
+  fs::rename(tmp, file_name);
+}
 
-    // add internal macros
-    Macros::macros(m8);
+void add_macros(M8& m8)
+{
+  // add internal macros
+  Macros::macros(m8);
 
-    // add cusom macros
-    Macros::macros_custom(m8);
+  // add cusom macros
+  Macros::macros_custom(m8);
+}
 
-    // list out all macros if --list option given
-    if (pg.get<bool>("list"))
+void set_options(M8& m8, OB::Parg& pg)
+{
+  // set debug option
+  m8.set_debug(pg.get<bool>("debug"));
+
+  // set comment option
+  m8.set_comment(pg.get("comment"));
+
+  // set ignore option
+  if (pg.find("ignore"))
+  {
+    m8.set_ignore(pg.get("ignore"));
+  }
+
+  // set async option
+  m8.set_async(std::stoul(pg.get("async")));
+
+  // set batch-compile option
+  m8.set_batch_compile(pg.get<bool>("batch-compile"));
+
+  // set exit-status option
+  m8.set_exit_status(pg.get<bool>("exit-status"));
+
+  // set readline option
+  m8.set_readline(pg.get<bool>("interactive"));
+
+  // set template-cache option
+  m8.set_template_cache(pg.get<bool>("template-cache"));
+
+  // set config file
+  m8.set_config(pg.get("config"));
+
+  // set no-copy option
+  m8.set_copy(! pg.get<bool>("no-copy"));
+
+  // set no-cache option, after the config which may also turn it off
+  if (pg.get<bool>("no-cache"))
+  {
+    m8.set_cache(false);
+  }
+
+  // set start and end delimiters
+  if (pg.find("mirror"))
+  {
+    auto delim = pg.get("mirror");
+    if (delim.size() <= 1)
     {
-      std::cout << m8.list_macros();
-      return 0;
+      throw std::runtime_error("delimiter must be at least 2 chars long");
     }
-
-    // output info on macro if --info option given
-    if (pg.find("info"))
+    auto rdelim = mirror_delim(delim);
+    m8.set_delimits(delim, rdelim);
+    Macros::m8_delim_start = delim;
+    Macros::m8_delim_end = rdelim;
+  }
+  else if (pg.find("start") && pg.find("end"))
+  {
+    auto delim_start = pg.get("start");
+    auto delim_end = pg.get("end");
+    if (delim_start.size() <= 1)
     {
-      std::cout << m8.macro_info(pg.get("info"));
-      return 0;
+      throw std::runtime_error("start delimiter must be at least 2 chars long");
+    }
+    if (delim_end.size() <= 1)
+    {
+      throw std::runtime_error("end delimiter must be at least 2 chars long");
     }
+    m8.set_delimits(delim_start, delim_end);
+    Macros::m8_delim_start = delim_start;
+    Macros::m8_delim_end = delim_end;
+  }
+
+  // the version and options an output depends on, for --incremental
+  m8.manifest().value("version", pg.version());
+  for (auto const& e : {"config", "comment", "ignore", "no-copy", "start", "end", "mirror", "async", "batch-compile", "exit-status"})
+  {
+    m8.manifest().value(e, pg.get(e));
+  }
+
+  // the program itself, so a rebuilt m8 makes its outputs stale
+  static auto const exe = []() {
+    std::error_code ec;
+    auto const path = fs::read_symlink("/proc/self/exe", ec);
+    return ec ? std::string() : path.string();
+  }();
+  if (! exe.empty())
+  {
+    m8.manifest().binary(exe);
+  }
+}
+
+std::string swap_path(std::string const& ofile)
+{
+  return ".m8/swp/" + OB::String::url_encode(ofile) + ".swp.m8";
+}
+
+fs::path output_path(fs::path const& odir, std::string const& ifile)
+{
+  // keep the relative path of the input,
+  // inputs outside of the working dir keep only their file name
+  auto const path = fs::path(ifile).lexically_normal();
+  if (path.is_absolute() || (! path.empty() && *path.begin() == ".."))
+  {
+    return odir / path.filename();
+  }
+  return odir / path;
+}
 
-    // set debug option
-    m8.set_debug(pg.get<bool>("debug"));
+// whether the output made from the inputs, in order, is up to date
+bool fresh(M8& m8, std::vector<std::string> const& ifiles, std::string const& ofile)
+{
+  std::string str;
+  for (auto const& e : ifiles)
+  {
+    str += e;
+    str += '\n';
+  }
+  m8.manifest().value("input", str);
 
-    // set comment option
-    m8.set_comment(pg.get("comment"));
+  return m8.manifest().fresh(ofile);
+}
+
+std::size_t run_jobs(M8& total, OB::Parg& pg, std::vector<std::string> const& ifiles)
+{
+  fs::path const odir {pg.get("output-dir")};
 
-    // set ignore option
-    if (pg.find("ignore"))
+  std::vector<std::string> ofiles;
+  std::map<std::string, std::string> seen;
+  for (auto const& e : ifiles)
+  {
+    auto const ofile = output_path(odir, e).string();
+    auto const [it, ok] = seen.emplace(ofile, e);
+    if (! ok)
     {
-      m8.set_ignore(pg.get("ignore"));
+      throw std::runtime_error("inputs '" + it->second + "' and '" + e + "' have the same output file '" + ofile + "'");
     }
+    ofiles.emplace_back(ofile);
+  }
+
+  auto jobs = std::stoul(pg.get("jobs"));
+  if (jobs == 0)
+  {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min<std::size_t>(jobs, ifiles.size());
 
-    // set readline option
-    m8.set_readline(pg.get<bool>("interactive"));
+  fs::create_directories(".m8/swp");
 
-    // set config file
-    m8.set_config(pg.get("config"));
+  bool const incremental {pg.get<bool>("incremental")};
 
-    // set no-copy option
-    m8.set_copy(! pg.get<bool>("no-copy"));
+  std::atomic<std::size_t> next {0};
+  std::size_t failed {0};
+  std::mutex mtx;
 
-    // set start and end delimiters
-    if (pg.find("mirror"))
+  auto const worker = [&]() {
+    // the macros are set up once per job
+    M8 m8;
+    try
     {
-      auto delim = pg.get("mirror");
-      if (delim.size() <= 1)
-      {
-        throw std::runtime_error("delimiter must be at least 2 chars long");
-      }
-      auto rdelim = mirror_delim(delim);
-      m8.set_delimits(delim, rdelim);
-      Macros::m8_delim_start = delim;
-      Macros::m8_delim_end = rdelim;
+      m8.share(total);
+      add_macros(m8);
+      set_options(m8, pg);
+      m8.keep();
+    }
+    catch (std::exception const& e)
+    {
+      std::lock_guard<std::mutex> lock {mtx};
+      ++failed;
+      std::cerr << aec::wrap("Error: ", aec::fg_red) << e.what() << "\n";
+      return;
     }
-    else if (pg.find("start") && pg.find("end"))
+
+    for (;;)
     {
-      auto delim_start = pg.get("start");
-      auto delim_end = pg.get("end");
-      if (delim_start.size() <= 1)
+      auto const i = next++;
+      if (i >= ifiles.size())
       {
-        throw std::runtime_error("start delimiter must be at least 2 chars long");
+        break;
+      }
+      auto const& ifile = ifiles.at(i);
+      auto const& ofile = ofiles.at(i);
+      auto const otmp = swap_path(ofile);
+
+      // every input starts from the same state, so an output does not
+      // depend on which inputs the same job processed before it
+      m8.reset();
+      Macros::reset();
+      try
+      {
+        if (incremental && fresh(m8, {ifile}, ofile))
+        {
+          std::lock_guard<std::mutex> lock {mtx};
+          total.add_stats(m8);
+          continue;
+        }
+
+        if (fs::exists(otmp))
+        {
+          throw std::runtime_error("swap file already exists for output file '" + ofile + "'");
+        }
+
+        m8.parse(ifile, ofile);
+
+        fs::path const p2 {ofile};
+        if (! p2.parent_path().empty())
+        {
+          fs::create_directories(p2.parent_path());
+        }
+        fs::rename(otmp, p2);
+
+        if (incremental)
+        {
+          m8.manifest().save(ofile);
+        }
+
+        std::lock_guard<std::mutex> lock {mtx};
+        total.add_stats(m8);
       }
-      if (delim_end.size() <= 1)
+      catch (std::exception const& e)
       {
-        throw std::runtime_error("end delimiter must be at least 2 chars long");
+        std::error_code ec;
+        fs::remove(otmp, ec);
+
+        std::lock_guard<std::mutex> lock {mtx};
+        ++failed;
+        total.add_stats(m8);
+        std::cerr << aec::wrap("Error: ", aec::fg_red) << "'" << ifile << "': " << e.what() << "\n";
       }
-      m8.set_delimits(delim_start, delim_end);
-      Macros::m8_delim_start = delim_start;
-      Macros::m8_delim_end = delim_end;
     }
+  };
+
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < jobs; ++i)
+  {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& e : pool)
+  {
+    e.join();
+  }
+
+  return failed;
+}
+
+int start_m8(OB::Parg& pg)
+{
+  // set mem-stats option, before the macros are compiled
+  M8::set_mem_stats(pg.get<bool>("mem-stats"));
+
+  // init M8 object, outside of the try so a failed run still has its metrics
+  M8 m8;
+
+  // write out metrics, also when the run failed
+  auto const write_metrics = [&](bool failed) {
+    if (pg.find("metrics-json"))
+    {
+      write_file(pg.get("metrics-json"), m8.metrics_json(failed));
+    }
+    if (pg.find("metrics-prom"))
+    {
+      write_file(pg.get("metrics-prom"), m8.metrics_prom(failed));
+    }
+  };
+
+  // the error of the run is shown first, then any error writing its metrics
+  auto const fail = [&]() {
+    try
+    {
+      write_metrics(true);
+    }
+    catch (std::exception const& e)
+    {
+      std::cerr << aec::wrap("Error: ", aec::fg_red) << e.what() << "\n";
+    }
+    return 1;
+  };
+
+  try
+  {
+    // add internal and custom macros
+    add_macros(m8);
+
+    // list out all macros if --list option given
+    if (pg.get<bool>("list"))
+    {
+      std::cout << m8.list_macros();
+      return 0;
+    }
+
+    // output info on macro if --info option given
+    if (pg.find("info"))
+    {
+      std::cout << m8.macro_info(pg.get("info"));
+      return 0;
+    }
+
+    // set options
+    set_options(m8, pg);
+
+    // set profile option
+    m8.set_profile(pg.get<bool>("profile"));
+
+    // set trace options
+    if (pg.find("trace"))
+    {
+      m8.set_trace(pg.get("trace"));
+    }
+    if (pg.find("trace-folded"))
+    {
+      m8.set_trace_folded(pg.get("trace-folded"));
+    }
+
+    // inputs that failed in --output-dir mode
+    std::size_t failed {0};
 
     // parse
     if (pg.get<bool>("interactive"))
@@ -305,35 +624,48 @@ int start_m8(OB::Parg& pg)
         throw std::runtime_error("expected input file");
       }
 
-      // setup swap directory and check if swap file already exists
-      if (! pg.get("output").empty())
+      if (pg.find("output-dir"))
       {
-        fs::create_directories(".m8/swp");
-        std::string otmp {".m8/swp/" + OB::String::url_encode(pg.get("output")) + ".swp.m8"};
-        fs::path ofile {otmp};
-        if (fs::exists(ofile))
-        {
-          throw std::runtime_error("swap file already exists for output file '" + pg.get("output") + "'");
-        }
+        failed = run_jobs(m8, pg, positionals);
       }
-
-      for (auto const& e : positionals)
+      else if (pg.get<bool>("incremental") && fresh(m8, positionals, pg.get("output")))
       {
-        m8.parse(e, pg.get("output"));
+        // the output is left as it is
       }
-
-      if (! pg.get("output").empty())
+      else
       {
-        std::string ofile {pg.get("output")};
-        fs::path fp {ofile};
-        std::string otmp {".m8/swp/" + OB::String::url_encode(fp) + ".swp.m8"};
-        fs::path p1 {otmp};
-        fs::path p2 {ofile};
-        if (! p2.parent_path().empty())
+        // setup swap directory and check if swap file already exists
+        if (! pg.get("output").empty())
         {
-          fs::create_directories(p2.parent_path());
+          fs::create_directories(".m8/swp");
+          fs::path ofile {swap_path(pg.get("output"))};
+          if (fs::exists(ofile))
+          {
+            throw std::runtime_error("swap file already exists for output file '" + pg.get("output") + "'");
+          }
+        }
+
+        for (auto const& e : positionals)
+        {
+          m8.parse(e, pg.get("output"));
+        }
+
+        if (! pg.get("output").empty())
+        {
+          std::string ofile {pg.get("output")};
+          fs::path p1 {swap_path(ofile)};
+          fs::path p2 {ofile};
+          if (! p2.parent_path().empty())
+          {
+            fs::create_directories(p2.parent_path());
+          }
+          fs::rename(p1, p2);
+
+          if (pg.get<bool>("incremental"))
+          {
+            m8.manifest().save(ofile);
+          }
         }
-        fs::rename(p1, p2);
       }
     }
 
@@ -344,21 +676,53 @@ int start_m8(OB::Parg& pg)
       {
         std::cerr << aec::wrap("File: ", aec::fg_magenta) << aec::wrap(pg.get("output"), aec::fg_green) << "\n";
       }
+      if (pg.find("output-dir"))
+      {
+        std::cerr << aec::wrap("Dir: ", aec::fg_magenta) << aec::wrap(pg.get("output-dir"), aec::fg_green) << "\n";
+      }
       std::cerr << m8.summary();
     }
 
-    return 0;
+    // print out profile
+    if (pg.get<bool>("profile"))
+    {
+      std::cerr << m8.profile();
+    }
+
+    // print out memory stats
+    if (pg.get<bool>("mem-stats"))
+    {
+      std::cerr << m8.mem_stats();
+    }
+
+    if (failed > 0)
+    {
+      std::cerr << aec::wrap("Error: ", aec::fg_red) << failed << " of " << pg.get_pos_vec().size() << " inputs failed\n";
+      return fail();
+    }
   }
   catch (std::exception const& e)
   {
     std::cerr << aec::wrap("Error: ", aec::fg_red) << e.what() << "\n";
-    return 1;
+    return fail();
   }
   catch (...)
   {
     std::cerr << aec::wrap("Error: ", aec::fg_red) << "an unexpected error occurred\n";
+    return fail();
+  }
+
+  try
+  {
+    write_metrics(false);
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << aec::wrap("Error: ", aec::fg_red) << e.what() << "\n";
     return 1;
   }
+
+  return 0;
 }
 
 int main(int argc, char *argv[])
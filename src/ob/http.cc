@@ -4,10 +4,113 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <cstdio>
+#include <cctype>
 
 #include <string>
 #include <vector>
 #include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+
+static std::atomic<std::size_t> requests_ {0};
+static std::atomic<std::size_t> connections_ {0};
+
+// process wide curl state, made on first use
+// the global init runs once, idle handles are kept for the next request,
+// and the share lets every handle reuse the same connections,
+// dns entries and tls sessions
+class Session
+{
+public:
+
+  static Session& get()
+  {
+    static Session session;
+    return session;
+  }
+
+  CURL* acquire()
+  {
+    CURL* curl_handle {nullptr};
+    {
+      std::lock_guard<std::mutex> lock {mtx_};
+      if (! idle_.empty())
+      {
+        curl_handle = idle_.back();
+        idle_.pop_back();
+      }
+    }
+
+    if (! curl_handle)
+    {
+      curl_handle = curl_easy_init();
+    }
+    if (curl_handle && share_)
+    {
+      curl_easy_setopt(curl_handle, CURLOPT_SHARE, share_);
+    }
+
+    return curl_handle;
+  }
+
+  // the handle keeps its connections through the reset
+  void release(CURL* curl_handle)
+  {
+    curl_easy_reset(curl_handle);
+
+    std::lock_guard<std::mutex> lock {mtx_};
+    idle_.emplace_back(curl_handle);
+  }
+
+private:
+
+  Session()
+  {
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    share_ = curl_share_init();
+    if (share_)
+    {
+      curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, Session::lock);
+      curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, Session::unlock);
+      curl_share_setopt(share_, CURLSHOPT_USERDATA, static_cast<void*>(this));
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+  }
+
+  ~Session()
+  {
+    for (auto const& e : idle_)
+    {
+      curl_easy_cleanup(e);
+    }
+    if (share_)
+    {
+      curl_share_cleanup(share_);
+    }
+    curl_global_cleanup();
+  }
+
+  static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userp)
+  {
+    static_cast<Session*>(userp)->locks_.at(static_cast<std::size_t>(data)).lock();
+  }
+
+  static void unlock(CURL*, curl_lock_data data, void* userp)
+  {
+    static_cast<Session*>(userp)->locks_.at(static_cast<std::size_t>(data)).unlock();
+  }
+
+  CURLSH* share_ {nullptr};
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+
+  std::mutex mtx_;
+  std::vector<CURL*> idle_;
+}; // class Session
 
 Http::Http()
 {
@@ -41,20 +144,24 @@ std::size_t Http::cb_write(void *contents, std::size_t size, std::size_t nmemb,
 
 int Http::run()
 {
-  CURL *curl_handle;
+  auto& session = Session::get();
+  CURL *curl_handle {session.acquire()};
   CURLcode ec;
 
-  curl_global_init(CURL_GLOBAL_ALL);
-  curl_handle = curl_easy_init();
+  if (! curl_handle)
+  {
+    res.status = -1;
+    return -1;
+  }
 
   if (req.method == "POST")
   {
     curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, req.data.c_str());
   }
 
+  struct curl_slist *headers = NULL;
   if (! req.headers.empty())
   {
-    struct curl_slist *headers = NULL;
     for (auto const &e : req.headers)
     {
       headers = curl_slist_append(headers, e.c_str());
@@ -67,6 +174,9 @@ int Http::run()
 
   curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 30L);
   curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, 30L);
+  curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+  // room for the idle connections of concurrent requests
+  curl_easy_setopt(curl_handle, CURLOPT_MAXCONNECTS, 64L);
 
   curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, Http::cb_header);
   curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, static_cast<void*>(&res));
@@ -82,8 +192,13 @@ int Http::run()
     code = -1;
   }
 
-  curl_easy_cleanup(curl_handle);
-  curl_global_cleanup();
+  long connects {0};
+  curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &connects);
+  ++requests_;
+  connections_ += static_cast<std::size_t>(connects);
+
+  session.release(curl_handle);
+  curl_slist_free_all(headers);
 
   // set http status code
   if (res.headers.empty())
@@ -99,3 +214,49 @@ int Http::run()
 
   return code;
 }
+
+std::string Http::header(std::string const& key) const
+{
+  for (auto const& e : res.headers)
+  {
+    auto const pos = e.find(':');
+    if (pos != key.size())
+    {
+      continue;
+    }
+
+    bool match {true};
+    for (std::size_t i = 0; i < pos; ++i)
+    {
+      if (std::tolower(static_cast<unsigned char>(e[i])) != key[i])
+      {
+        match = false;
+        break;
+      }
+    }
+    if (! match)
+    {
+      continue;
+    }
+
+    auto const begin = e.find_first_not_of(" \t", pos + 1);
+    auto const end = e.find_last_not_of(" \t\r\n");
+    if (begin == std::string::npos || end < begin)
+    {
+      return {};
+    }
+    return e.substr(begin, end - begin + 1);
+  }
+
+  return {};
+}
+
+std::size_t Http::requests()
+{
+  return requests_;
+}
+
+std::size_t Http::connections()
+{
+  return connections_;
+}
@@ -1,6 +1,8 @@
 #ifndef OB_HTTP_HH
 #define OB_HTTP_HH
 
+#include <cstddef>
+
 #include <string>
 #include <vector>
 
@@ -13,6 +15,13 @@ public:
 
   int run();
 
+  // value of a response header, or empty, the key is lowercase
+  std::string header(std::string const& key) const;
+
+  // totals over every request in the process
+  static std::size_t requests();
+  static std::size_t connections();
+
   struct Req
   {
     std::string method {"GET"};
@@ -40,6 +40,33 @@ public:
     }
   }
 
+  // the scopes hold iterators into the map,
+  // so a copy finds its own elements again
+  Scoped_Map(Scoped_Map const& other):
+    _map {other._map}
+  {
+    for (auto const& scope : other._it)
+    {
+      auto& v = _it.emplace_back();
+      for (auto const& e : scope)
+      {
+        v.emplace_back(_map.find(e->first));
+      }
+    }
+  }
+
+  Scoped_Map(Scoped_Map&&) = default;
+
+  Scoped_Map& operator=(Scoped_Map const& other)
+  {
+    Scoped_Map tmp {other};
+    std::swap(_map, tmp._map);
+    std::swap(_it, tmp._it);
+    return *this;
+  }
+
+  Scoped_Map& operator=(Scoped_Map&&) = default;
+
   ~Scoped_Map()
   {
   }
@@ -1,35 +1,377 @@
 #include "ob/sys_command.hh"
 
+#include <spawn.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <cstddef>
+
 #include <string>
 #include <array>
-#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+extern char** environ;
 
 namespace OB
 {
 
-int exec(std::string& result, std::string const& command)
+static std::atomic<std::size_t> exec_count_ {0};
+
+// the err pipe is only made when err is set, otherwise stderr is inherited
+static int run(std::vector<std::string> const& argv, std::string& out, std::string* err)
 {
-  const char* cmd {command.c_str()};
+  if (argv.empty())
+  {
+    return -1;
+  }
+
+  int fd_out[2];
+  int fd_err[2] {-1, -1};
+  if (pipe2(fd_out, O_CLOEXEC) != 0)
+  {
+    return -1;
+  }
+  if (err && pipe2(fd_err, O_CLOEXEC) != 0)
+  {
+    close(fd_out[0]);
+    close(fd_out[1]);
+    return -1;
+  }
+
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, fd_out[1], STDOUT_FILENO);
+  if (err)
+  {
+    posix_spawn_file_actions_adddup2(&fa, fd_err[1], STDERR_FILENO);
+  }
+
+  std::vector<char*> args;
+  for (auto const& e : argv)
+  {
+    args.emplace_back(const_cast<char*>(e.c_str()));
+  }
+  args.emplace_back(nullptr);
+
+  ++exec_count_;
+  pid_t pid {-1};
+  int const ec {posix_spawnp(&pid, args.at(0), &fa, nullptr, args.data(), environ)};
+  posix_spawn_file_actions_destroy(&fa);
+
+  close(fd_out[1]);
+  if (err)
+  {
+    close(fd_err[1]);
+  }
+  if (ec != 0)
+  {
+    close(fd_out[0]);
+    if (err)
+    {
+      close(fd_err[0]);
+      *err += "could not run '" + argv.at(0) + "'";
+    }
+    return -1;
+  }
+
+  // read both pipes as they fill, so neither blocks the child
+  std::array<pollfd, 2> fds {{{fd_out[0], POLLIN, 0}, {fd_err[0], POLLIN, 0}}};
+  std::array<std::string*, 2> dst {&out, err};
+  std::size_t open_fds {err ? 2ul : 1ul};
+  std::vector<char> buf (64 * 1024);
+  while (open_fds > 0)
+  {
+    // a closed pipe has a negative fd, which poll skips
+    if (poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
 
-  int const buf_len {1024};
-  std::array<char, buf_len> buf;
+    for (std::size_t i = 0; i < fds.size(); ++i)
+    {
+      auto& e = fds.at(i);
+      if (e.fd < 0 || ! (e.revents & (POLLIN | POLLHUP | POLLERR)))
+      {
+        continue;
+      }
 
-  std::shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
+      auto const n = read(e.fd, buf.data(), buf.size());
+      if (n > 0)
+      {
+        dst.at(i)->append(buf.data(), static_cast<std::size_t>(n));
+      }
+      else if (n == 0 || errno != EINTR)
+      {
+        close(e.fd);
+        e.fd = -1;
+        --open_fds;
+      }
+    }
+  }
+  for (auto const& e : fds)
+  {
+    if (e.fd >= 0)
+    {
+      close(e.fd);
+    }
+  }
 
-  if (!pipe)
+  int status {0};
+  while (waitpid(pid, &status, 0) < 0)
+  {
+    if (errno != EINTR)
+    {
+      return -1;
+    }
+  }
+  if (! WIFEXITED(status))
   {
     return -1;
   }
 
-  while (!feof(pipe.get()))
+  return WEXITSTATUS(status);
+}
+
+int spawn(std::vector<std::string> const& argv, std::string& out, std::string& err)
+{
+  return run(argv, out, &err);
+}
+
+int exec(std::string& result, std::string const& command)
+{
+  return run({"/bin/sh", "-c", command}, result, nullptr);
+}
+
+int exec(std::string& result, std::string& err, std::string const& command)
+{
+  return run({"/bin/sh", "-c", command}, result, &err);
+}
+
+std::size_t exec_count()
+{
+  return exec_count_;
+}
+
+namespace
+{
+
+// blocks SIGPIPE on the calling thread while in scope,
+// so a write to a program that exited fails with EPIPE instead of ending m8,
+// the signal it raised is taken before the old mask is put back
+struct Sigpipe_Guard
+{
+  Sigpipe_Guard()
+  {
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+  }
+
+  ~Sigpipe_Guard()
   {
-    if (fgets(buf.data(), buf_len, pipe.get()) != nullptr)
+    // a signal pending from before belongs to someone else
+    if (! sigismember(&old, SIGPIPE))
     {
-      result += buf.data();
+      sigset_t pending;
+      sigpending(&pending);
+      if (sigismember(&pending, SIGPIPE))
+      {
+        timespec const zero {0, 0};
+        while (sigtimedwait(&set, nullptr, &zero) < 0 && errno == EINTR)
+        {
+        }
+      }
     }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
   }
 
-  return 0;
+  sigset_t set;
+  sigset_t old;
+}; // struct Sigpipe_Guard
+
+} // namespace
+
+// waits until the fd is ready for the events, false when the deadline passed first
+static bool ready(int fd, short events, std::chrono::steady_clock::time_point deadline)
+{
+  for (;;)
+  {
+    auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0)
+    {
+      return false;
+    }
+    pollfd fds {fd, events, 0};
+    auto const n = poll(&fds, 1, static_cast<int>(left));
+    if (n < 0 && errno != EINTR)
+    {
+      throw std::runtime_error("could not poll the coprocess");
+    }
+    if (n > 0)
+    {
+      return true;
+    }
+  }
+}
+
+Coprocess::Coprocess(std::string const& command, int timeout):
+  timeout_ {timeout}
+{
+  int in[2];
+  int out[2];
+  if (pipe2(in, O_CLOEXEC) != 0)
+  {
+    throw std::runtime_error("could not create a pipe");
+  }
+  if (pipe2(out, O_CLOEXEC) != 0)
+  {
+    close(in[0]);
+    close(in[1]);
+    throw std::runtime_error("could not create a pipe");
+  }
+
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+
+  std::string const cmd {"exec " + command};
+  char const* argv[] {"sh", "-c", cmd.c_str(), nullptr};
+
+  ++exec_count_;
+  int const ec {posix_spawn(&pid_, "/bin/sh", &fa, nullptr, const_cast<char* const*>(argv), environ)};
+  posix_spawn_file_actions_destroy(&fa);
+
+  close(in[0]);
+  close(out[1]);
+  if (ec != 0)
+  {
+    close(in[1]);
+    close(out[0]);
+    throw std::runtime_error("could not start '" + command + "'");
+  }
+
+  in_ = in[1];
+  out_ = out[0];
+}
+
+Coprocess::~Coprocess()
+{
+  close(in_);
+  close(out_);
+
+  // a program that does not stop at the end of its input, or hangs, is ended
+  if (wait(grace_))
+  {
+    return;
+  }
+  kill(pid_, SIGTERM);
+  if (wait(grace_))
+  {
+    return;
+  }
+  kill(pid_, SIGKILL);
+  int status {0};
+  while (waitpid(pid_, &status, 0) < 0 && errno == EINTR)
+  {
+  }
+}
+
+bool Coprocess::wait(int ms)
+{
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  for (;;)
+  {
+    int status {0};
+    auto const pid = waitpid(pid_, &status, WNOHANG);
+    if (pid == pid_ || (pid < 0 && errno != EINTR))
+    {
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline)
+    {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+std::string Coprocess::call(std::string const& line)
+{
+  std::lock_guard<std::mutex> lock {mtx_};
+
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_);
+  auto const timed_out = [&]() {
+    return std::runtime_error("coprocess did not answer within " + std::to_string(timeout_ / 1000) + "s");
+  };
+
+  std::string const req {line + "\n"};
+  std::size_t done {0};
+  {
+    Sigpipe_Guard const sigpipe;
+    while (done < req.size())
+    {
+      if (! ready(in_, POLLOUT, deadline))
+      {
+        throw timed_out();
+      }
+      auto const n = write(in_, req.data() + done, req.size() - done);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        throw std::runtime_error("coprocess is not reading its input");
+      }
+      done += static_cast<std::size_t>(n);
+    }
+  }
+
+  std::array<char, 4096> buf;
+  for (;;)
+  {
+    auto const pos = buf_.find('\n');
+    if (pos != std::string::npos)
+    {
+      auto res = buf_.substr(0, pos);
+      buf_.erase(0, pos + 1);
+      return res;
+    }
+
+    if (! ready(out_, POLLIN, deadline))
+    {
+      throw timed_out();
+    }
+    auto const n = read(out_, buf.data(), buf.size());
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::runtime_error("could not read from coprocess");
+    }
+    if (n == 0)
+    {
+      throw std::runtime_error("coprocess exited");
+    }
+    buf_.append(buf.data(), static_cast<std::size_t>(n));
+  }
 }
 
 } // namespace OB
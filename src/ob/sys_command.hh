@@ -1,13 +1,69 @@
 #ifndef OB_SYS_COMMAND_HH
 #define OB_SYS_COMMAND_HH
 
+#include <sys/types.h>
+
+#include <cstddef>
+
 #include <string>
+#include <vector>
+#include <mutex>
 
 namespace OB
 {
 
+// run argv without a shell, the program is searched for in PATH
+// stdout is appended to out and stderr to err
+// returns the exit status, or -1 when it could not be run or was ended by a signal
+int spawn(std::vector<std::string> const& argv, std::string& out, std::string& err);
+
+// run a command line with the shell, stderr is passed through
+// returns the same as spawn
 int exec(std::string& result, std::string const& command);
 
+// run a command line with the shell, stderr is appended to err
+int exec(std::string& result, std::string& err, std::string const& command);
+
+// number of child processes started by exec and coprocesses
+std::size_t exec_count();
+
+// a program started once, that answers each line written to its stdin
+// with one line on its stdout
+class Coprocess
+{
+public:
+
+  // the command is run by the shell, which is replaced by the program,
+  // a call not answered within timeout milliseconds fails
+  explicit Coprocess(std::string const& command, int timeout = 60000);
+  // closes its stdin and waits for it to exit,
+  // ending it with SIGTERM, then SIGKILL, when it does not
+  ~Coprocess();
+
+  Coprocess(Coprocess const&) = delete;
+  Coprocess& operator=(Coprocess const&) = delete;
+
+  // write a line, without its newline, and read the answer,
+  // calls from many threads take turns
+  std::string call(std::string const& line);
+
+private:
+
+  // time given to exit, after closing its stdin and after SIGTERM
+  static int constexpr grace_ {1000};
+
+  // waits for the program to exit, at most ms milliseconds
+  bool wait(int ms);
+
+  std::mutex mtx_;
+  int timeout_ {60000};
+  pid_t pid_ {-1};
+  int in_ {-1};
+  int out_ {-1};
+  // read past the last answer
+  std::string buf_;
+}; // class Coprocess
+
 } // namespace OB
 
 #endif // OB_SYS_COMMAND_HH
@@ -0,0 +1,44 @@
+#!/usr/bin/env sh
+# the macros in the result of an async call are expanded,
+# giving the same output as running the calls in order
+# usage: async_rescan.sh <m8>
+set -e
+
+m8="$1"
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+printf '#!/bin/sh\nprintf %s "[M8[ repeat \\"z\\", $1 ]8M]"\n' "'%s'" > mk
+chmod +x mk
+PATH="$dir:$PATH"
+export PATH
+
+cat > m8.json << 'END'
+{
+  "macros": [
+    {
+      "name": "mk",
+      "info": "prints a call to repeat",
+      "usage": "mk n",
+      "regex": "^([0-9]+)$",
+      "mode": "shell"
+    }
+  ]
+}
+END
+
+cat > a.m8 << 'END'
+a [M8[ mk 3 ]8M] b [M8[ mk 2 ]8M]
+  [M8[ mk 1 ]8M]
+[M8[ mk 4 ]8M]
+x[M8[ mk 2 ]8M]y
+END
+
+"$m8" a.m8 -c m8.json -o in_order.txt
+"$m8" a.m8 -c m8.json -o async.txt --async 4
+
+if grep -q 'M8' in_order.txt || ! cmp -s in_order.txt async.txt; then
+  printf 'expected:\n%s\ngot:\n%s\n' "$(cat in_order.txt)" "$(cat async.txt)"
+  exit 1
+fi
@@ -0,0 +1,29 @@
+#!/usr/bin/env sh
+# the macros in the output of snippets compiled together are expanded,
+# giving the same output as compiling each snippet on its own
+# usage: batch_compile_rescan.sh <m8>
+set -e
+
+m8="$1"
+command -v gcc > /dev/null || exit 77
+command -v g++ > /dev/null || exit 77
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+# the delimiters are printed in parts, so they do not end the snippet
+cat > a.m8 << 'END'
+[M8[ set cpp-headers #include <cstdio> ]8M]
+a [M8[ c printf("[M%d[ repeat \"z\", 3 ]%dM]", 8, 8); ]8M] b
+  [M8[ c printf("[M%d[ repeat \"y\", 2 ]%dM]", 8, 8); ]8M]
+[M8[ cpp std::printf("[M%d[ repeat \"x\", 4 ]%dM]", 8, 8); ]8M]
+END
+
+"$m8" a.m8 -o single.txt
+rm -rf .m8
+"$m8" a.m8 -o batch.txt --batch-compile
+
+if grep -q 'M8' single.txt || ! cmp -s single.txt batch.txt; then
+  printf 'expected:\n%s\ngot:\n%s\n' "$(cat single.txt)" "$(cat batch.txt)"
+  exit 1
+fi
@@ -0,0 +1,26 @@
+#!/usr/bin/env sh
+# a snippet compiled before is compiled again when a header it includes changes
+# usage: compile_cache_headers.sh <m8>
+set -e
+
+m8="$1"
+command -v gcc > /dev/null || exit 77
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+cat > a.m8 << 'END'
+[M8[ set c-flags -I. ]8M]
+[M8[ set c-headers #include "x.h" ]8M]
+v [M8[ c printf("%d", VAL); ]8M]
+END
+
+printf '#define VAL 1\n' > x.h
+"$m8" a.m8 -o 1.txt
+printf '#define VAL 2\n' > x.h
+"$m8" a.m8 -o 2.txt
+
+if [ "$(cat 2.txt)" != "v 2" ]; then
+  printf 'expected:\nv 2\ngot:\n%s\n' "$(cat 2.txt)"
+  exit 1
+fi
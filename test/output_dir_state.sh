@@ -0,0 +1,30 @@
+#!/usr/bin/env sh
+# inputs run by the same job must not see each other's macro state
+# usage: output_dir_state.sh <m8>
+set -e
+
+m8="$1"
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+printf 'C\n' > c.txt
+cat > a.m8 << 'END'
+[M8[ set x leaked ]8M]A
+[M8[ def 'hi' leaked ]8M]
+[M8[ m8:hook+ b 'B' 'leaked' ]8M]
+[M8[ m8:include_once 'c.txt' ]8M]
+END
+cat > b.m8 << 'END'
+B[M8[ get x ]8M]
+[M8[ info hi ]8M]
+[M8[ m8:include_once 'c.txt' ]8M]
+END
+
+"$m8" a.m8 b.m8 -O out -j 1
+"$m8" b.m8 -o alone.txt
+
+if ! cmp -s out/b.m8 alone.txt; then
+  printf 'expected:\n%s\ngot:\n%s\n' "$(cat alone.txt)" "$(cat out/b.m8)"
+  exit 1
+fi
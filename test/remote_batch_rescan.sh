@@ -0,0 +1,67 @@
+#!/usr/bin/env sh
+# the macros in the results of a batched remote macro are expanded,
+# giving the same output as sending the calls one at a time
+# usage: remote_batch_rescan.sh <m8>
+set -e
+
+m8="$1"
+command -v python3 > /dev/null || exit 77
+dir="$(mktemp -d)"
+cd "$dir"
+
+# answers a call with a call to repeat, a batch with an array of them
+cat > server.py << 'END'
+import http.server, json, sys
+
+class Handler(http.server.BaseHTTPRequestHandler):
+  def do_POST(self):
+    req = json.loads(self.rfile.read(int(self.headers['Content-Length'])))
+    res = lambda e: '[M8[ repeat "z", ' + e['args'][1] + ' ]8M]'
+    if isinstance(req, list):
+      body = json.dumps([res(e) for e in req])
+    else:
+      body = res(req)
+    body = body.encode()
+    self.send_response(200)
+    self.send_header('Content-Length', str(len(body)))
+    self.end_headers()
+    self.wfile.write(body)
+
+  def log_message(self, *args):
+    pass
+
+srv = http.server.HTTPServer(('127.0.0.1', 0), Handler)
+with open(sys.argv[1], 'w') as f:
+  f.write(str(srv.server_address[1]))
+srv.serve_forever()
+END
+
+python3 server.py port &
+pid=$!
+trap 'kill $pid; rm -rf "$dir"' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+  [ -s port ] && break
+  sleep 0.2
+done
+url="http://127.0.0.1:$(cat port)"
+
+config() {
+  printf '{"macros": [{"name": "mk", "info": "prints a call to repeat", "usage": "mk n", "regex": "^([0-9]+)$", "url": "%s", "batch": %s}]}\n' "$url" "$1"
+}
+config false > single.json
+config true > batch.json
+
+cat > a.m8 << 'END'
+a [M8[ mk 3 ]8M] b [M8[ mk 2 ]8M]
+  [M8[ mk 1 ]8M]
+[M8[ mk 4 ]8M]
+x[M8[ mk 2 ]8M]y
+END
+
+"$m8" a.m8 -c single.json -o single.txt 2> /dev/null
+"$m8" a.m8 -c batch.json -o batch.txt 2> /dev/null
+
+if grep -q 'M8' single.txt || ! cmp -s single.txt batch.txt; then
+  printf 'expected:\n%s\ngot:\n%s\n' "$(cat single.txt)" "$(cat batch.txt)"
+  exit 1
+fi
@@ -0,0 +1,37 @@
+#!/usr/bin/env sh
+# a run with the template cache, cold, warm, or damaged, matches a run without it
+# usage: template_cache.sh <m8>
+set -e
+
+m8="$1"
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+cat > a.m8 <<'M8'
+[M8[ repeat "ab", 3 ]8M] [M8[ repeat "ab", 3 ]8M]
+[M8[ substr 1 3 [M8[ repeat "xyz", 2 ]8M] ]8M]
+  [M8[ substr 0 2 hello ]8M]
+M8
+
+# a call too long to keep
+long="$(printf 'long%.0s' $(seq 1 300))"
+printf '[M8[ substr 0 4 %s ]8M]\n' "$long" >> a.m8
+
+"$m8" a.m8 -o plain.txt
+
+for run in cold warm damaged; do
+  if [ "$run" = damaged ]; then
+    printf 'junk' > .m8/skel/a.m8.bin
+  fi
+  "$m8" a.m8 -o "$run.txt" --template-cache
+  if ! cmp -s plain.txt "$run.txt"; then
+    printf '%s run, expected:\n%s\ngot:\n%s\n' "$run" "$(cat plain.txt)" "$(cat "$run.txt")"
+    exit 1
+  fi
+done
+
+if grep -q "$long" .m8/skel/a.m8.bin; then
+  printf 'a call longer than the limit was kept\n'
+  exit 1
+fi